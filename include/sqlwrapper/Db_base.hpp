@@ -43,6 +43,9 @@ namespace sqlwrapper{
 	template<typename Db_tag> struct DbConnectInfo; //specialize : put connection info in this class
 	template<typename Db_tag> struct DbTransaction; //specialize : put Transasction object in this class
 	template<typename Db_tag> struct DbSavepoint;   //specialize : put Save point  object in this class
+	template<typename Db_tag> struct DbPool;        //specialize : put a pool of connections to the same database in this class
+	template<typename Db_tag> struct DbBackup;      //specialize : put online backup of a database in this class
+	template<typename Db_tag> struct DbCheckpointer;//specialize : put background checkpoints of a database log in this class
 	template<typename Db_tag> struct Sql;           //specialize : typedef Sql<Db_tag>::type as SQL data type
 
 
@@ -146,6 +149,9 @@ inline std::ostream & operator<<(std::ostream &out, const sqlwrapper::Column_inf
   typedef ::sqlwrapper::DbManager<tag>      DbManager_t;\
   typedef ::sqlwrapper::DbTransaction<tag>  DbTransaction_t;\
   typedef ::sqlwrapper::DbSavepoint<tag>    DbSavepoint_t;\
+  typedef ::sqlwrapper::DbPool<tag>         DbPool_t;\
+  typedef ::sqlwrapper::DbBackup<tag>       DbBackup_t;\
+  typedef ::sqlwrapper::DbCheckpointer<tag> DbCheckpointer_t;\
   typedef typename ::sqlwrapper::Sql<tag>::type    Sql_t;\
   typedef typename ::sqlwrapper::Rowid<tag>::type  Rowid_t;
 
@@ -0,0 +1,98 @@
+//============================================================================
+// Name        : ByteSize
+// Author      : Pierre BLAVY
+// Version     : 1.0
+// Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
+// Description : byte_size(t) estimates the memory used by t, including heap
+//               buffers owned by t (strings, vectors, tuples of them...)
+//               specialize Byte_size_t for your own types
+//============================================================================
+
+/*
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see
+    <https://www.gnu.org/licenses/lgpl-3.0.en.html>.
+*/
+
+
+#ifndef INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_BYTESIZE_HPP_
+#define INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_BYTESIZE_HPP_
+
+#include <string>
+#include <vector>
+#include <tuple>
+#include <utility>
+
+namespace sqlwrapper{
+namespace mt_impl{
+
+	//heap bytes owned by T, sizeof(T) is not included
+	template<typename T>
+	struct Byte_size_t{
+		static size_t heap(const T&){return 0;}
+	};
+
+	template<typename T>
+	size_t byte_size_heap(const T &t){return Byte_size_t<T>::heap(t);}
+
+	//total size of t
+	template<typename T>
+	size_t byte_size(const T &t){return sizeof(T)+byte_size_heap(t);}
+
+
+
+	template<typename C, typename Tr, typename A>
+	struct Byte_size_t<std::basic_string<C,Tr,A> >{
+		typedef std::basic_string<C,Tr,A> T;
+		static size_t heap(const T&t){
+			//short strings are stored inside the object
+			const char *p     = reinterpret_cast<const char*>(t.data());
+			const char *begin = reinterpret_cast<const char*>(&t);
+			if(p>=begin and p<begin+sizeof(T)){return 0;}
+			return (t.capacity()+1)*sizeof(C);
+		}
+	};
+
+	template<typename U, typename A>
+	struct Byte_size_t<std::vector<U,A> >{
+		static size_t heap(const std::vector<U,A>&t){
+			size_t r = t.capacity()*sizeof(U);
+			for(const auto &u : t){r+=byte_size_heap(u);}
+			return r;
+		}
+	};
+
+	template<typename U, typename V>
+	struct Byte_size_t<std::pair<U,V> >{
+		static size_t heap(const std::pair<U,V>&t){return byte_size_heap(t.first)+byte_size_heap(t.second);}
+	};
+
+	template<typename... Args>
+	struct Byte_size_t<std::tuple<Args...> >{
+		static size_t heap(const std::tuple<Args...>&t){return run(t,std::integral_constant<size_t,sizeof...(Args)>());}
+
+		private:
+		static size_t run(const std::tuple<Args...>&, std::integral_constant<size_t,0>){return 0;}
+
+		template<size_t I>
+		static size_t run(const std::tuple<Args...>&t, std::integral_constant<size_t,I>){
+			return byte_size_heap(std::get<I-1>(t)) + run(t,std::integral_constant<size_t,I-1>());
+		}
+	};
+
+
+}//end namespace mt_impl
+}//end namespace sqlwrapper
+
+
+#endif /* INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_BYTESIZE_HPP_ */
@@ -5,8 +5,9 @@
 // Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
 // Description : A multithread job pool  the main thread fetch data
 //               - the main thread fetches data
-//               - the main thread spawn child threads to handle the data
+//               - workers of a persistent ThreadPool_t handle the data
 //               - some data is locally cached in pages (i.e. vectors)
+//               - pages are handed to the workers through a lock free ring
 //============================================================================
 
 /*
@@ -32,31 +33,193 @@ This program is free software: you can redistribute it and/or modify
 
 
 #include <vector>
-#include <deque>
 #include <atomic>
-#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 #include <type_traits>
 #include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "mt_ThreadPool.hpp"
+#include "mt_ByteSize.hpp"
+#include "mt_RingBuffer.hpp"
 
 namespace sqlwrapper{
 namespace mt_impl{
 
 
+//default number of worker loops : keep a core for the fetcher and one for the rest of the world
+inline size_t guess_thread_number(){
+	size_t i = std::thread::hardware_concurrency();
+	if(i>2){i=i-2;}
+	else{i=1;}
+	return i;
+}
+
+//index of the JobPool_t worker loop running on the calling thread, in [0,JobPool_options::max_thread_number())
+//use it to give each worker its own data (e.g., an accumulator)
+inline size_t & job_worker_index(){
+	static thread_local size_t i=0;
+	return i;
+}
+
+//tuning of a JobPool_t run, 0 means "guess"
+struct JobPool_options{
+	size_t page_size =128; //maximum number of rows in a page
+	size_t max_pages =0;   //maximum number of pages fetched and not yet processed
+	size_t max_bytes =0;   //maximum estimated bytes of pages fetched and not yet processed, 0 = no limit
+	                       //each page gets max_bytes/(max_thread_number()+1) bytes (JobPool_page::max_bytes) : peak_bytes
+	                       //stays below max_bytes if fetch_fn respects it (a page holds at least one row, whatever its size)
+	size_t threads   =0;   //number of worker loops
+	bool   sequential=false; //fetch and process everything on the calling thread
+
+	//adaptive mode : page_size is only the first page size, and max_pages an upper bound.
+	//fetch and process times are measured while running, the page size is tuned so that processing
+	//a page takes about target_page_time, and fewer pages are kept in flight when the fetcher is the bottleneck.
+	//the chosen values are in JobPool_stats, copy them to page_size and max_pages to pin them.
+	bool   adaptive     =false;
+	std::chrono::microseconds target_page_time{1000};
+	size_t max_page_size=65536;
+
+	//scaling : when max_threads is set, worker loops are added while pages back up (up to max_threads),
+	//and a worker that waited idle_time for a page retires (down to min_threads, at least 1).
+	//the run starts with threads worker loops, clamped to [min_threads,max_threads]
+	size_t min_threads=0;
+	size_t max_threads=0;
+	std::chrono::microseconds idle_time{2000};
+
+	//work stealing : when steal_chunk is set, pages are processed by chunks of steal_chunk rows, and a worker
+	//that finds no page takes chunks of the pages other workers are processing. A slow page is then shared
+	//instead of making one worker the straggler. process_fn may be called several times for a page,
+	//each time with a part of its rows (and the page seq), so it must not rely on seeing whole pages.
+	size_t steal_chunk=0;
+
+	//cancellation : when *cancel becomes true, no more page is fetched, and pages already fetched are dropped.
+	//the flag belongs to the caller, and may be set from any thread
+	const std::atomic<bool> *cancel=nullptr;
+
+	//called once, from the thread that sees it, when the job stops before its end : cancellation, process_fn
+	//returned false, or an exception. Pages fetched and not processed are dropped after it, so use it to wake
+	//whatever waits for them. It must not throw
+	std::function<void()> on_stop;
+
+	size_t thread_number()const{return threads==0 ? guess_thread_number() : threads;}
+
+	//number of worker indexes a run may use, clamped like JobPool_t does (min_threads wins over max_threads)
+	size_t max_thread_number()const{
+		if(max_threads==0){return thread_number();}
+		return std::max(max_threads,std::max<size_t>(min_threads,1));
+	}
+};
+
+//what happened during the last JobPool_t run
+struct JobPool_stats{
+	size_t pages          =0;
+	size_t rows           =0;
+	size_t peak_pages     =0; //maximum number of pages in flight
+	size_t peak_bytes     =0; //maximum estimated bytes in flight (computed only when max_bytes is set)
+
+	//allocations : in steady state, pages and rows are recycled instead of allocated
+	size_t pages_allocated=0; //new pages
+	size_t pages_recycled =0; //pages taken from the free list
+	size_t rows_allocated =0; //new row objects, recycled rows are not counted
+
+	size_t worker_sleeps  =0; //times a worker found the ring empty after spinning, and slept
+
+	//worker loops
+	size_t threads        =0; //at start
+	size_t peak_threads   =0;
+	size_t threads_started=0; //added while running
+	size_t threads_retired=0;
+
+	//values used at the end of the run (tuned in adaptive mode)
+	size_t page_size      =0;
+	size_t max_pages      =0;
+	double fetch_ns_per_row  =0; //measured in adaptive mode
+	double process_ns_per_row=0;
+
+	size_t chunks_stolen  =0; //work stealing
+
+	//early termination : process_fn returned false, or the job was cancelled
+	bool   stopped        =false;
+	size_t pages_skipped  =0; //fetched, then dropped because the job stopped
+};
+
+
+
+//a page of rows. seq is the page number, in fetch order
+//pages are recycled : clear() keeps the row objects (and the buffers they own, e.g. string capacity),
+//and next_row() gives them back to be overwritten
+//a page may also be a view on rows [first,count) of another page (work stealing), views are only read
+template<typename Data_t>
+struct JobPool_page{
+	typedef std::vector<Data_t>            Rows;
+	typedef typename Rows::iterator       iterator;
+	typedef typename Rows::const_iterator const_iterator;
+	typedef Data_t                         value_type;
+
+	size_t seq=0;
+	size_t limit=0;  //rows the fetcher should put in this page, 0 : fetch_fn decides
+	size_t max_bytes=0; //byte_size the fetcher should not exceed in this page, 0 : no limit
+	Rows   rows;     //rows[first,count) are used, the others are kept for recycling
+	size_t first=0;
+	size_t count=0;
+	JobPool_page *source=nullptr; //view : rows are in source
+
+	iterator       begin()      {return storage().begin()+first;}
+	iterator       end()        {return storage().begin()+count;}
+	const_iterator begin()const {return storage().begin()+first;}
+	const_iterator end()  const {return storage().begin()+count;}
+	size_t         size() const {return count-first;}
+	bool           empty()const {return count==first;}
+	Data_t &       back()       {return storage()[count-1];}
+	Data_t &       operator[](size_t i){return storage()[first+i];}
+	void           reserve(size_t i){rows.reserve(i);}
+	void           clear(){first=0; count=0;}
+
+	void view(JobPool_page &p, size_t first_, size_t last_){
+		seq   =p.seq;
+		source=&p;
+		first =p.first+first_;
+		count =p.first+last_;
+	}
+
+	//a row to overwrite : recycled rows keep their previous content
+	Data_t & next_row(){
+		if(count==rows.size()){rows.emplace_back();}
+		return rows[count++];
+	}
+
+	template<typename... Args> void emplace_back(Args&&... args){
+		if(count==rows.size()){rows.emplace_back(std::forward<Args>(args)...);}
+		else                  {rows[count]=Data_t(std::forward<Args>(args)...);}
+		++count;
+	}
+
+private:
+	Rows &       storage()     {return source==nullptr ? rows : source->rows;}
+	const Rows & storage()const{return source==nullptr ? rows : source->rows;}
+};
+
+template<typename Data_t>
+struct Byte_size_t<JobPool_page<Data_t> >{
+	static size_t heap(const JobPool_page<Data_t>&p){return byte_size_heap(p.rows);}
+};
+
+
 
 template<
   typename Data_t,
-  typename Fetch_t, //ex : bool fetch_fn (std::vector<Data_t> & write_here);
+  typename Fetch_t, //ex : bool fetch_fn (JobPool_page<Data_t> & write_here);
   typename Process_t//ex : void process_fn(Page &p);
 >
 struct JobPool_t{
 
-	static size_t guess_thread_number(){
-		size_t i = std::thread::hardware_concurrency();
-		if(i>2){i=i-2;}
-		else{i=1;}
-		return i;
-	}
-
+	static size_t guess_thread_number(){return ::sqlwrapper::mt_impl::guess_thread_number();}
 	static size_t guess_page_number(){return guess_thread_number()*10;}
 
 	JobPool_t(
@@ -68,24 +231,38 @@ struct JobPool_t{
 		max_pages(max_pages_),
 		max_thread(max_thread_),
 		fetch_fn(fetch_fn_),
-		process_fn(process_fn_),
-		future_pool(max_thread_){}
+		process_fn(process_fn_){}
+
+	JobPool_t(
+			Fetch_t   fetch_fn_,
+			Process_t process_fn_,
+			const JobPool_options &o
+	):
+		max_pages (o.max_pages==0 ? guess_page_number()   : o.max_pages),
+		max_thread(o.thread_number()),
+		max_bytes (o.max_bytes),
+		sequential(o.sequential),
+		page_size (o.page_size),
+		adaptive  (o.adaptive),
+		max_page_size(std::max<size_t>(o.max_page_size,1)),
+		target_ns (std::chrono::duration_cast<std::chrono::nanoseconds>(o.target_page_time).count()),
+		thread_min(o.max_threads==0 ? 0 : std::max<size_t>(o.min_threads,1)),
+		thread_max(o.max_threads==0 ? 0 : std::max(o.max_threads,thread_min)),
+		idle_time (o.idle_time),
+		cancel    (o.cancel),
+		on_stop   (o.on_stop),
+		steal_chunk(o.steal_chunk),
+		fetch_fn(fetch_fn_),
+		process_fn(process_fn_)
+	{
+		if(thread_max!=0){max_thread=std::min(std::max(max_thread,thread_min),thread_max);}
+	}
 
-	typedef std::vector<Data_t> Page;
+	typedef JobPool_page<Data_t> Page;
 
 private:
 	typedef JobPool_t<Data_t, Fetch_t, Process_t> This_t;
 
-	typedef void(*process_wrapper)(std::unique_ptr<Page> &&p);
-	typedef decltype(
-		std::async(std::launch::async,
-		static_cast<process_wrapper>(nullptr),
-		std::unique_ptr<Page>(nullptr)
-	)) future_t;
-
-
-
-
 
 public:
 
@@ -104,87 +281,531 @@ public:
 
 	size_t    get_max_pages()   const{return max_pages;}
 	size_t    get_max_threads() const{return max_thread;}
+	size_t    get_max_bytes()   const{return max_bytes;}
+	const JobPool_stats & get_stats()const{return stats;}
 	Fetch_t   get_fetch_fn()    const{return fetch_fn;}
 	Process_t get_process_fn()  const{return process_fn;}
 
 	void set_max_pages  (const size_t    &s){max_pages=s;}
-	void set_max_threads(const size_t    &s){max_thread=s;future_pool.resize(s);}
+	void set_max_threads(const size_t    &s){max_thread=s;}
+	void set_max_bytes  (const size_t    &s){max_bytes=s;}
 	void set_fetch_fn   (const Fetch_t   &s){fetch_fn=s;}
 	void set_process_fn (const Process_t &s){process_fn=s;}
 
+	//the calling thread fetches pages, workers of ThreadPool_t::global() process them (FIFO).
+	//pages go through a lock free ring : a worker takes the next page as soon as it is done with one,
+	//it spins a little when the ring is empty, then sleeps until the fetcher pushes a page.
+	//the fetcher sleeps while max_pages pages are fetched but not processed,
+	//or while fetching a page of page_bytes (or as big as the last one) would exceed max_bytes (unless nothing is in flight).
+	//the first exception thrown by fetch_fn or process_fn stops the job, and is rethrown here.
+	//process_fn may return bool : false stops the job like a cancellation (see JobPool_options::cancel)
 	void run(){
-		//if(max_pages<max_thread){max_pages=max_thread;}
-
-		bool more_data=true;
-		do{
+		if(max_pages ==0){max_pages =1;}
+		if(max_thread==0){max_thread=1;}
+		stats=JobPool_stats();
+		stats.page_size=page_size;
+		stats.max_pages=max_pages;
+		page_bytes=0;
+		if(max_bytes!=0){page_bytes=std::max<size_t>(max_bytes/(std::max(max_thread,thread_max)+1),1);}
+
+		//nested call from a worker : waiting for other workers may deadlock, so do everything here
+		if(sequential or ThreadPool_t::in_worker()){run_inline(); return;}
+
+		fetch_done     =false;
+		error_flag     =false;
+		error          =nullptr;
+		in_flight      =0;
+		in_flight_bytes=0;
+		free_bytes     =0;
+		sleepers       =0;
+		worker_sleeps  =0;
+		fetcher_waiting=false;
+		stopped        =false;
+		stop_notified  =false;
+		pages_skipped  =0;
+		process_ns     =0;
+		process_rows   =0;
+		queued         =0;
+		active         =max_thread;
+		threads_retired=0;
+		stats.threads     =max_thread;
+		stats.peak_threads=max_thread;
+
+		//scaling : indexes of the workers that may be added
+		free_index.clear();
+		for(size_t i = std::max(thread_max,max_thread); i > max_thread; --i){free_index.push_back(i-1);}
+		page_limit     =max_pages;
+		if(adaptive){page_limit=std::min(max_pages,2*max_thread);}
+
+		chunks_stolen  =0;
+		steal_count    =0;
+		if(steal_chunk!=0){
+			//a state is busy while its page has rows to claim (at most one per worker) or rows being processed (idem)
+			steal_count=2*std::max(max_thread,thread_max)+1;
+			steal_states.reset(new Steal_state[steal_count]);
+		}
 
+		//at most max_pages pages are in flight, and at most max_pages+max_thread pages exist
+		data      .reset(new Ring(max_pages+1));
+		free_pages.reset(new Ring(max_pages+max_thread+1));
+
+		ThreadPool_t &pool = ThreadPool_t::global();
+		pool.reserve(std::max(max_thread,thread_max)); //every worker loop runs at the same time, up to pool.max_threads() : loops never wait for each other
+		running=max_thread;
+		for(size_t i = 0; i < max_thread; ++i){pool.submit([this,i](){worker_loop(i);});}
+
+		try{
+			bool   more_data=true;
+			size_t last_bytes=0;
+			while(more_data){
+				wait_space(std::max(last_bytes,page_bytes));
+				if(error_flag or is_stopped()){break;}
+
+				Slot slot;
+				if(free_pages->try_pop(slot)){
+					free_bytes-=slot.bytes;
+					slot.bytes=0;
+					++stats.pages_recycled;
+				}else{
+					slot.page.reset(new Page);
+					++stats.pages_allocated;
+				}
 
-			//wait if queue is full
-			if(data.size()+1>=max_pages){
-				//wait until at least one thread finishes
-				thread_available_mt.lock();
+				const size_t rows_before=slot.page->rows.size();
+				slot.page->seq  =stats.pages;
+				slot.page->limit=stats.page_size;
+				slot.page->max_bytes=page_bytes;
+				const auto fetch_begin = adaptive ? Clock::now() : Clock::time_point();
+				more_data = fetch_fn(*slot.page);
+				const auto fetch_end   = adaptive ? Clock::now() : Clock::time_point();
+				stats.rows_allocated+=slot.page->rows.size()-rows_before;
+				if(max_bytes!=0){slot.bytes=byte_size(*slot.page);}
+				last_bytes=slot.bytes;
+				const size_t fetched=slot.page->size();
+
+				++stats.pages;
+				stats.rows+=slot.page->size();
+				const size_t pages=++in_flight;
+				const size_t bytes=(in_flight_bytes+=slot.bytes);
+				if(pages>stats.peak_pages){stats.peak_pages=pages;}
+				if(bytes>stats.peak_bytes){stats.peak_bytes=bytes;}
+
+				//never full : there is room for max_pages+1 pages
+				++queued;
+				while(!data->try_push(slot)){std::this_thread::yield();}
+				wake_worker();
+				if(thread_max!=0){grow();}
+
+				if(adaptive){tune(fetched,fetch_end-fetch_begin);}
 			}
+		}catch(...){
+			set_error(std::current_exception());
+		}
 
+		//be sure that every worker finishes
+		{
+			std::unique_lock<std::mutex> l(park_mutex);
+			fetch_done=true;
+			data_cond.notify_all();
+			space_cond.wait(l,[this]{return running==0;});
+		}
+		stats.worker_sleeps  =worker_sleeps;
+		stats.threads_retired=threads_retired;
+		stats.stopped        =is_stopped();
+		stats.pages_skipped  =pages_skipped;
+		stats.chunks_stolen  =chunks_stolen;
+		steal_states.reset();
+		data.reset();
+		free_pages.reset();
+
+		if(error){std::rethrow_exception(error);}
+	}
 
-			//fetch some data, set more_data
-			if(more_data and data.size()<max_pages){
-				data.emplace_back(new Page);
-				more_data = fetch_fn(*data.back()) ;
-			}
+private:
+	struct Slot{
+		std::unique_ptr<Page> page;
+		size_t bytes=0;
+	};
+	typedef RingBuffer_t<Slot> Ring;
+	typedef std::chrono::steady_clock Clock;
+
+	//number of empty ring polls before a worker sleeps
+	static constexpr size_t spin_count=64;
+
+	bool has_space(size_t next_bytes)const{
+		const size_t pages=in_flight;
+		if(pages==0){return true;} //always progress
+		if(pages>=page_limit){return false;}
+		return max_bytes==0 or in_flight_bytes+next_bytes<=max_bytes;
+	}
 
-			//then try to re-launch each finished thread
-			//note that when a thread finishes, it unlocks thread_available_mt
-			if(!data.empty()){
-			for(size_t i = 0; i <future_pool.size() ; ++i ){
+	//fetcher side
+	void wait_space(size_t next_bytes){
+		if(error_flag or has_space(next_bytes)){return;}
+		std::unique_lock<std::mutex> l(park_mutex);
+		fetcher_waiting=true;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		space_cond.wait(l,[&]{return error_flag or has_space(next_bytes);});
+		fetcher_waiting=false;
+	}
 
-				bool launch;
-				if( future_pool[i].valid()){
-					launch=future_pool[i].wait_for(std::chrono::milliseconds(0)) == std::future_status::ready;
-				}else{
-					launch=true;
-				}
+	//scaling : one more worker loop when pages wait faster than workers take them
+	void grow(){
+		if(queued<=active){return;}
+
+		size_t index;
+		{
+			std::unique_lock<std::mutex> l(park_mutex);
+			if(error_flag or active>=thread_max or free_index.empty()){return;}
+			index=free_index.back();
+			free_index.pop_back();
+			++active;
+			++running;
+			++stats.threads_started;
+			if(active>stats.peak_threads){stats.peak_threads=active;}
+		}
+		ThreadPool_t::global().submit([this,index](){worker_loop(index);});
+	}
 
+	void wake_worker(){
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(sleepers!=0){
+			std::unique_lock<std::mutex> l(park_mutex);
+			data_cond.notify_one();
+		}
+	}
 
-				if(launch){
-					if(!data.empty()){
-						std::unique_ptr<Page> tmp(nullptr);
-						std::swap(data.back(),tmp);
-						data.pop_back();
-
-						auto process_wrapper = [&](std::unique_ptr<Page> &&p){
-							std::unique_ptr<Page> local_copy;
-							std::swap(p,local_copy);
-							process_fn(*local_copy);
-							thread_available_mt.unlock();
-						};
-						future_pool[i]=std::async(std::launch::async,process_wrapper,std::move(tmp)); //todo
-					}else{break;}
+	//worker side
+	void wake_fetcher(){
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if(fetcher_waiting){
+			std::unique_lock<std::mutex> l(park_mutex);
+			space_cond.notify_all();
+		}
+	}
+
+	void set_error(std::exception_ptr e){
+		{
+			std::unique_lock<std::mutex> l(park_mutex);
+			if(!error){error=e;}
+			error_flag=true;
+			data_cond.notify_all();
+			space_cond.notify_all();
+		}
+		notify_stop();
+	}
+
+	bool is_stopped(){
+		if(stopped.load(std::memory_order_relaxed)){return true;}
+		if(cancel!=nullptr and cancel->load(std::memory_order_relaxed)){stop();}
+		return stopped;
+	}
+
+	void stop(){
+		stopped=true;
+		notify_stop();
+	}
+
+	//see JobPool_options::on_stop
+	void notify_stop(){
+		if(on_stop and !stop_notified.exchange(true)){on_stop();}
+	}
+
+	//false if process_fn asks to stop
+	bool process(Page &page){
+		typedef typename std::is_same<decltype(process_fn(page)),bool>::type Returns_bool;
+		return process(page,Returns_bool());
+	}
+	bool process(Page &page, std::true_type ){return process_fn(page);}
+	bool process(Page &page, std::false_type){process_fn(page); return true;}
+
+	bool pop(Slot &slot){
+		if(!data->try_pop(slot)){return false;}
+		--queued;
+		return true;
+	}
+
+	//pop the next page, false when the job is over, or when the worker retires.
+	//fetch_done is read before popping : once it is set, an empty ring stays empty
+	bool next_page(Slot &slot){
+		for(size_t i = 0; i < spin_count; ++i){
+			if(error_flag){return false;}
+			const bool done=fetch_done;
+			if(pop(slot)){return true;}
+			if(steal_chunk!=0 and steal()){i=0; continue;}
+			if(done){return false;}
+			std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> l(park_mutex);
+		++sleepers;
+		++worker_sleeps;
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		bool got=false;
+		auto ready=[&]{
+			if(error_flag){return true;}
+			const bool done=fetch_done;
+			got=pop(slot);
+			return got or done;
+		};
+
+		if(thread_max==0){data_cond.wait(l,ready);}
+		else{
+			//scaling : starving for idle_time, retire
+			while(!data_cond.wait_for(l,idle_time,ready)){
+				if(active>thread_min){
+					--active;
+					++threads_retired;
+					free_index.push_back(job_worker_index());
+					break;
 				}
 			}
+		}
+		--sleepers;
+		return got;
+	}
+
+	void worker_loop(size_t index){
+		job_worker_index()=index;
+		Slot slot;
+		while(next_page(slot)){
+			if(is_stopped()){++pages_skipped;} //drain
+			else if(steal_chunk!=0){share(slot); continue;}
+			else{run_process(*slot.page);}
+			finish_page(slot);
+		}
+
+		//notify with the lock held : once running==0, run() may return and destroy this
+		std::unique_lock<std::mutex> l(park_mutex);
+		--running;
+		space_cond.notify_all();
+	}
+
+	void run_process(Page &page){
+		const auto process_begin = adaptive ? Clock::now() : Clock::time_point();
+		if(!is_stopped()){
+			try{if(!process(page)){stop();}}
+			catch(...){set_error(std::current_exception());}
+		}
+		if(adaptive){
+			process_ns  +=std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now()-process_begin).count();
+			process_rows+=page.size();
+		}
+	}
+
+	//a page is processed : recycle it, unless kept pages would exceed the byte budget
+	void finish_page(Slot &slot){
+		in_flight_bytes-=slot.bytes;
+		if(max_bytes==0 or in_flight_bytes+free_bytes+slot.bytes<=max_bytes){
+			const size_t bytes=slot.bytes;
+			slot.page->clear();
+			free_bytes+=bytes;
+			if(!free_pages->try_push(slot)){free_bytes-=bytes;}
+		}
+		slot.page.reset(); //not recycled
+		slot.bytes=0;
+
+		--in_flight;
+		wake_fetcher();
+	}
+
+	//work stealing : a page being processed by chunks.
+	//rows [0,cursor) are claimed, rows done are processed, the thread that processes the last rows finishes the page.
+	//users counts threads that may claim a chunk : a state is reused only when users==0
+	struct Steal_state{
+		std::atomic<bool>   in_use{false};
+		std::atomic<bool>   open  {false};
+		std::atomic<size_t> users {0};
+		std::atomic<size_t> cursor{0};
+		std::atomic<size_t> done  {0};
+		size_t              size  =0;
+		Slot                slot;
+	};
+
+	Steal_state & acquire_state(){
+		while(true){
+			for(size_t i = 0; i < steal_count; ++i){
+				bool in_use=false;
+				if(steal_states[i].in_use.compare_exchange_strong(in_use,true)){
+					while(steal_states[i].users!=0){std::this_thread::yield();}
+					return steal_states[i];
+				}
 			}
-		}while(more_data or !data.empty());
+			std::this_thread::yield(); //cannot happen, see steal_count
+		}
+	}
 
-		//be sure that every thread finishes
-		for(size_t i = 0; i <future_pool.size() ; ++i ){
-			if(future_pool[i].valid()){future_pool[i].get();}
+	//publish the page, and process its chunks until none is left to claim
+	void share(Slot &slot){
+		Steal_state &state = acquire_state();
+		state.size  =slot.page->size();
+		state.cursor=0;
+		state.done  =0;
+		state.slot  =std::move(slot);
+		if(state.size==0){
+			Slot empty = std::move(state.slot);
+			state.in_use=false;
+			finish_page(empty);
+			return;
 		}
+		++state.users; //the owner too : the state is not reused while it may claim
+		state.open.store(true,std::memory_order_release);
+		while(process_chunk(state)){}
+		--state.users;
 	}
 
-private:
-	void static_check(){
-		typedef decltype(process_fn(Page())) process_fn_return_t;
-		static_assert(std::is_same<process_fn_return_t,bool>::value, "process_fn must return bool");
+	//claim and process a chunk of state, false if there was nothing to claim
+	bool process_chunk(Steal_state &state){
+		const size_t first = state.cursor.fetch_add(steal_chunk);
+		if(first>=state.size){return false;}
+		const size_t last  = std::min(first+steal_chunk,state.size);
+
+		Page chunk;
+		chunk.view(*state.slot.page,first,last);
+		run_process(chunk);
+
+		if(state.done.fetch_add(last-first)+(last-first)==state.size){
+			state.open=false;
+			Slot finished = std::move(state.slot);
+			state.in_use=false;
+			finish_page(finished);
+		}
+		return true;
+	}
+
+	//process a chunk of a page another worker is processing, false if there is none
+	bool steal(){
+		const size_t start = job_worker_index();
+		for(size_t i = 0; i < steal_count; ++i){
+			Steal_state &state = steal_states[(start+i)%steal_count];
+			if(!state.open.load(std::memory_order_acquire)){continue;}
+			++state.users;
+			const bool got = state.open.load(std::memory_order_acquire) and process_chunk(state);
+			--state.users;
+			if(got){
+				++chunks_stolen;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//fetcher side, adaptive mode : called after each page
+	void tune(size_t rows, Clock::duration fetch_time){
+		if(rows==0){return;}
+		auto average=[](double old, double now){return old==0 ? now : 0.75*old+0.25*now;};
+
+		const double fetch_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(fetch_time).count();
+		stats.fetch_ns_per_row=average(stats.fetch_ns_per_row,fetch_ns/rows);
+
+		const size_t p_rows = process_rows.exchange(0);
+		const double p_ns   = process_ns  .exchange(0);
+		if(p_rows==0){return;} //nothing processed since the last call
+		stats.process_ns_per_row=average(stats.process_ns_per_row,p_ns/p_rows);
+
+		//processing a page takes about target_ns : long enough to hide the hand over cost, short enough to balance the workers.
+		//move by at most a factor 2 per page, measures are noisy
+		const double per_row = std::max(stats.process_ns_per_row,1.0);
+		const double wanted  = std::max(1.0, std::min<double>(target_ns/per_row, max_page_size));
+		const size_t current = std::max<size_t>(stats.page_size,1);
+		const size_t lo      = std::max<size_t>(current/2,1);
+		const size_t hi      = current*2;
+		stats.page_size = std::min(max_page_size, std::min(hi, std::max(lo, static_cast<size_t>(wanted))));
+
+		//workers are the bottleneck : keep a spare page per worker.
+		//the fetcher is the bottleneck : pages do not pile up, more of them would only use memory
+		const size_t threads = active;
+		const bool fetch_bound = stats.fetch_ns_per_row*threads > stats.process_ns_per_row;
+		page_limit = std::max<size_t>(1,std::min(max_pages, fetch_bound ? threads+1 : 2*threads));
+		stats.max_pages=page_limit;
+	}
+
+	void run_inline(){
+		//nested runs have their own indexes
+		struct Index_guard{
+			size_t saved=job_worker_index();
+			Index_guard(){job_worker_index()=0;}
+			~Index_guard(){job_worker_index()=saved;}
+		} index_guard;
+
+		stopped=false;
+		stop_notified=false;
+		bool more_data=true;
+		Page page;
+		stats.pages_allocated=1;
+		try{
+			while(more_data){
+				const size_t rows_before=page.rows.size();
+				page.clear();
+				page.seq  =stats.pages;
+				page.limit=stats.page_size;
+				page.max_bytes=page_bytes;
+				more_data = fetch_fn(page);
+				stats.rows_allocated+=page.rows.size()-rows_before;
+				++stats.pages;
+				stats.rows+=page.size();
+				stats.peak_pages=1;
+				if(!process(page)){stop();}
+				if(is_stopped()){break;}
+			}
+		}catch(...){
+			notify_stop();
+			throw;
+		}
+		stats.stopped=is_stopped();
 	}
 
 	size_t max_pages ;
 	size_t max_thread;
+	size_t max_bytes=0;
+	size_t page_bytes=0;  //share of max_bytes of a page, set by run()
+	bool   sequential=false;
+	size_t page_size=0;   //0 : fetch_fn decides
+	bool   adaptive =false;
+	size_t max_page_size=65536;
+	double target_ns=1e6;
+	size_t thread_min=0;  //scaling bounds, thread_max==0 : no scaling
+	size_t thread_max=0;
+	std::chrono::microseconds idle_time{2000};
+	const std::atomic<bool> *cancel=nullptr;
+	std::function<void()>    on_stop;
+	size_t steal_chunk=0; //0 : no work stealing
+	size_t page_limit=0;  //pages in flight allowed now, at most max_pages
+	JobPool_stats stats;
 
 	Fetch_t   fetch_fn  =nullptr;
 	Process_t process_fn=nullptr;
 
-	std::deque< std::unique_ptr<Page> > data;
-	std::vector<future_t> future_pool;
-	std::mutex thread_available_mt;
+	//shared between the fetcher and the workers
+	std::unique_ptr<Ring>   data;       //fetched pages, not yet processed
+	std::unique_ptr<Ring>   free_pages; //processed pages, ready to be refilled
+	std::atomic<size_t>     in_flight      {0}; //pages fetched and not yet processed
+	std::atomic<size_t>     in_flight_bytes{0};
+	std::atomic<size_t>     free_bytes     {0};
+	std::atomic<bool>       fetch_done     {false};
+	std::atomic<bool>       error_flag     {false};
+	std::atomic<bool>       stopped        {false};
+	std::atomic<bool>       stop_notified  {false};
+	std::atomic<size_t>     pages_skipped  {0};
+	std::atomic<size_t>     chunks_stolen  {0};
+	std::unique_ptr<Steal_state[]> steal_states;
+	size_t                  steal_count=0;
+	std::atomic<bool>       fetcher_waiting{false};
+	std::atomic<size_t>     sleepers       {0}; //workers sleeping on data_cond
+	std::atomic<size_t>     worker_sleeps  {0};
+	std::atomic<size_t>     process_rows   {0}; //adaptive mode : measures since the last tune
+	std::atomic<uint64_t>   process_ns     {0};
+	std::atomic<size_t>     queued         {0}; //pages in the ring
+	std::atomic<size_t>     active         {0}; //worker loops not retired, changed with park_mutex locked
+
+	//sleeping only, the ring is not protected by park_mutex
+	std::mutex              park_mutex;
+	std::condition_variable data_cond;  //a page is available, or the job ends
+	std::condition_variable space_cond; //a page was processed, or a worker ended
+	size_t                  running   =0;   //worker loops not yet finished
+	size_t                  threads_retired=0;
+	std::vector<size_t>     free_index; //scaling : worker indexes not in use
+	std::exception_ptr      error;
 };
 
 
@@ -211,7 +832,21 @@ struct JobPool_run{
 		p.run();
 	}
 
-	typedef std::vector<Data_t> Page;
+	template<
+	  typename Fetch_t,
+	  typename Process_t
+	>
+	static JobPool_stats run(
+			Fetch_t fetch_fn,
+			Process_t process_fn,
+			const JobPool_options &options
+	){
+		JobPool_t<Data_t,Fetch_t,Process_t> p(fetch_fn,process_fn,options);
+		p.run();
+		return p.get_stats();
+	}
+
+	typedef JobPool_page<Data_t> Page;
 
 };
 
@@ -0,0 +1,188 @@
+//============================================================================
+// Name        : Lock
+// Author      : Pierre BLAVY
+// Version     : 1.0
+// Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
+// Description : A lock whose policy is chosen when it is built
+//               - None   : no synchronization, for objects used by one thread at a time
+//               - Mutex  : std::mutex
+//               - Spin   : spin lock, for short critical sections with few threads
+//               - Shared : readers/writer lock, readers run concurrently
+//               Lock_guard_t does nothing when the calling thread already holds the lock
+//============================================================================
+
+/*
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see
+    <https://www.gnu.org/licenses/lgpl-3.0.en.html>.
+*/
+
+
+#ifndef INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_LOCK_HPP_
+#define INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_LOCK_HPP_
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+
+namespace sqlwrapper{
+namespace mt_impl{
+
+
+//lock and unlock are not reentrant (BasicLockable), use Lock_guard_t for reentrant sections
+//with policies other than Shared, lock_shared is lock
+struct Lock_t{
+	enum class Policy{None, Mutex, Spin, Shared};
+
+	explicit Lock_t(Policy p=Policy::Mutex):policy_(p){}
+	Lock_t(const Lock_t &)=delete;
+	Lock_t& operator=(const Lock_t &)=delete;
+
+	Policy policy()const{return policy_;}
+
+	void lock(){
+		switch(policy_){
+			case Policy::None  : return;
+			case Policy::Mutex : mutex.lock(); break;
+			case Policy::Spin  : spin_lock(); break;
+			case Policy::Shared: shared_lock(); break;
+		}
+		owner.store(std::this_thread::get_id(),std::memory_order_relaxed);
+	}
+
+	void unlock(){
+		if(policy_==Policy::None){return;}
+		owner.store(std::thread::id(),std::memory_order_relaxed);
+		switch(policy_){
+			case Policy::None  : break;
+			case Policy::Mutex : mutex.unlock(); break;
+			case Policy::Spin  : spin.store(false,std::memory_order_release); break;
+			case Policy::Shared: shared_unlock(); break;
+		}
+	}
+
+	void lock_shared(){
+		if(policy_!=Policy::Shared){lock(); return;}
+		{
+			std::unique_lock<std::mutex> l(mutex);
+			shared_cv.wait(l,[this]{return !writer and writers_waiting==0;});
+			++readers;
+		}
+		shared_held().push_back(this);
+	}
+
+	void unlock_shared(){
+		if(policy_!=Policy::Shared){unlock(); return;}
+		auto &h = shared_held();
+		auto it = std::find(h.begin(),h.end(),this);
+		assert(it!=h.end()); //unlock_shared without lock_shared on this thread
+		h.erase(it);
+		std::unique_lock<std::mutex> l(mutex);
+		if(--readers==0){shared_cv.notify_all();}
+	}
+
+	//true if the calling thread holds the lock, shared or not
+	//(only this thread writes its own id in owner, so a relaxed load is enough)
+	bool held()const{
+		if(owner.load(std::memory_order_relaxed)==std::this_thread::get_id()){return true;}
+		if(policy_!=Policy::Shared){return false;}
+		const auto &h = shared_held();
+		return std::find(h.begin(),h.end(),this)!=h.end();
+	}
+
+
+private:
+	//Shared locks held by the calling thread
+	static std::vector<const Lock_t*> & shared_held(){
+		static thread_local std::vector<const Lock_t*> v;
+		return v;
+	}
+
+	//Shared : mutex protects readers, writer and writers_waiting (C++11 has no shared_mutex)
+	//waiting writers block new readers, so a stream of readers cannot starve them
+	void shared_lock(){
+		std::unique_lock<std::mutex> l(mutex);
+		++writers_waiting;
+		shared_cv.wait(l,[this]{return !writer and readers==0;});
+		--writers_waiting;
+		writer=true;
+	}
+
+	void shared_unlock(){
+		std::unique_lock<std::mutex> l(mutex);
+		writer=false;
+		shared_cv.notify_all();
+	}
+
+	void spin_lock(){
+		size_t spins=0;
+		while(spin.exchange(true,std::memory_order_acquire)){
+			while(spin.load(std::memory_order_relaxed)){
+				if(++spins>=64){spins=0; std::this_thread::yield();}
+			}
+		}
+	}
+
+	const Policy                 policy_;
+	std::atomic<std::thread::id> owner{std::thread::id()};
+	std::mutex                   mutex;
+	std::atomic<bool>            spin{false};
+	std::condition_variable      shared_cv;
+	size_t                       readers=0;
+	size_t                       writers_waiting=0;
+	bool                         writer=false;
+};
+
+
+
+//RAII section on a Lock_t, exclusive or shared
+//nested sections of the same thread (e.g., a write from a getApply callback) run in the outer one :
+//a shared section cannot be upgraded, writes nested in reads are only protected from other writers
+template<bool shared>
+struct Lock_guard_t{
+	explicit Lock_guard_t(Lock_t &l):lock(l.policy()==Lock_t::Policy::None or l.held() ? nullptr : &l){
+		if(lock==nullptr){return;}
+		if(shared){lock->lock_shared();}
+		else      {lock->lock();}
+	}
+
+	Lock_guard_t(Lock_guard_t &&g):lock(g.lock){g.lock=nullptr;}
+	Lock_guard_t(const Lock_guard_t &)=delete;
+	Lock_guard_t& operator=(const Lock_guard_t &)=delete;
+
+	~Lock_guard_t(){unlock();}
+
+	//leave the section before destruction
+	void unlock(){
+		if(lock==nullptr){return;}
+		if(shared){lock->unlock_shared();}
+		else      {lock->unlock();}
+		lock=nullptr;
+	}
+
+private:
+	Lock_t *lock;
+};
+
+
+
+}//end namespace mt_impl
+}//end namespace sqlwrapper
+
+
+#endif /* INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_LOCK_HPP_ */
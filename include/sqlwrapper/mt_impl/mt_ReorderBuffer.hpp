@@ -0,0 +1,117 @@
+//============================================================================
+// Name        : ReorderBuffer
+// Author      : Pierre BLAVY
+// Version     : 1.0
+// Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
+// Description : Give back results produced in parallel, in sequence order
+//               - workers push (seq, value) in any order
+//               - sink(value) is called in seq order, never concurrently
+//               - a push more than capacity ahead of the next value blocks
+//               - abort() gives up : waiting pushes return, next pushes are ignored
+//============================================================================
+
+/*
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see
+    <https://www.gnu.org/licenses/lgpl-3.0.en.html>.
+*/
+
+
+#ifndef INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_REORDERBUFFER_HPP_
+#define INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_REORDERBUFFER_HPP_
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+
+namespace sqlwrapper{
+namespace mt_impl{
+
+
+//The thread that pushes the next expected value drains every consecutive value.
+//Blocking is deadlock free as long as values are produced in seq order by FIFO workers:
+//the worker holding the next value is never blocked.
+//If a seq will never be pushed (its producer stopped or failed), call abort(), or later pushes wait forever.
+template<typename T, typename Sink_t> //ex : void sink(T &&t);
+struct ReorderBuffer_t{
+
+	ReorderBuffer_t(Sink_t &sink_, size_t capacity_):
+		sink(sink_),capacity(capacity_==0 ? 1 : capacity_){}
+
+	ReorderBuffer_t(const ReorderBuffer_t &)=delete;
+	ReorderBuffer_t& operator=(const ReorderBuffer_t &)=delete;
+
+	//if sink throws, the exception goes to the pushing thread, and the buffer is aborted
+	void push(size_t seq, T &&t){
+		std::unique_lock<std::mutex> l(mutex);
+		cond.wait(l,[&]{return aborted or seq<next+capacity;});
+		if(aborted){return;}
+
+		pending.emplace(seq,std::move(t));
+		if(draining){return;}
+
+		draining=true;
+		while(!aborted and !pending.empty() and pending.begin()->first==next){
+			T value = std::move(pending.begin()->second);
+			pending.erase(pending.begin());
+			l.unlock();
+
+			try{sink(std::move(value));}
+			catch(...){
+				l.lock();
+				aborted =true;
+				draining=false;
+				pending.clear();
+				cond.notify_all();
+				throw;
+			}
+
+			l.lock();
+			++next;
+			cond.notify_all();
+		}
+		draining=false;
+	}
+
+	//wake waiting pushes, drop pending values, and ignore next pushes. sink is not called anymore
+	void abort(){
+		std::unique_lock<std::mutex> l(mutex);
+		aborted=true;
+		pending.clear();
+		cond.notify_all();
+	}
+
+	size_t size(){
+		std::unique_lock<std::mutex> l(mutex);
+		return pending.size();
+	}
+
+private:
+	Sink_t &                sink;
+	const size_t            capacity;
+	std::map<size_t,T>      pending;
+	size_t                  next    =0;
+	bool                    draining=false;
+	bool                    aborted =false;
+	std::mutex              mutex;
+	std::condition_variable cond;
+};
+
+
+
+}//end namespace mt_impl
+}//end namespace sqlwrapper
+
+
+#endif /* INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_REORDERBUFFER_HPP_ */
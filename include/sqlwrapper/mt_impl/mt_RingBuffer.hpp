@@ -0,0 +1,128 @@
+//============================================================================
+// Name        : RingBuffer
+// Author      : Pierre BLAVY
+// Version     : 1.0
+// Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
+// Description : A lock free bounded multi producer multi consumer queue
+//               - try_push and try_pop never block, they fail when full / empty
+//               - each cell has a sequence number (D. Vyukov's bounded MPMC queue)
+//============================================================================
+
+/*
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see
+    <https://www.gnu.org/licenses/lgpl-3.0.en.html>.
+*/
+
+
+#ifndef INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_RINGBUFFER_HPP_
+#define INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_RINGBUFFER_HPP_
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <utility>
+
+
+namespace sqlwrapper{
+namespace mt_impl{
+
+
+//T must be default constructible and movable. Popped cells are left moved from.
+template<typename T>
+struct RingBuffer_t{
+
+	//capacity is rounded up to a power of two
+	explicit RingBuffer_t(size_t capacity_){
+		size_t c=2;
+		while(c<capacity_){c*=2;}
+		mask =c-1;
+		cells.reset(new Cell[c]);
+		for(size_t i = 0; i < c; ++i){cells[i].seq.store(i,std::memory_order_relaxed);}
+		enqueue_pos.store(0,std::memory_order_relaxed);
+		dequeue_pos.store(0,std::memory_order_relaxed);
+	}
+
+	RingBuffer_t(const RingBuffer_t &)=delete;
+	RingBuffer_t& operator=(const RingBuffer_t &)=delete;
+
+	size_t capacity()const{return mask+1;}
+
+	//false if the queue is full, t is then left untouched
+	bool try_push(T &t){
+		Cell  *cell;
+		size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+		while(true){
+			cell = &cells[pos & mask];
+			const size_t seq = cell->seq.load(std::memory_order_acquire);
+			const std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+			if(dif==0){
+				if(enqueue_pos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){break;}
+			}
+			else if(dif<0){return false;}
+			else{pos = enqueue_pos.load(std::memory_order_relaxed);}
+		}
+		cell->data = std::move(t);
+		cell->seq.store(pos+1,std::memory_order_release);
+		return true;
+	}
+
+	//false if the queue is empty
+	bool try_pop(T &t){
+		Cell  *cell;
+		size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+		while(true){
+			cell = &cells[pos & mask];
+			const size_t seq = cell->seq.load(std::memory_order_acquire);
+			const std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos+1);
+			if(dif==0){
+				if(dequeue_pos.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed)){break;}
+			}
+			else if(dif<0){return false;}
+			else{pos = dequeue_pos.load(std::memory_order_relaxed);}
+		}
+		t = std::move(cell->data);
+		cell->seq.store(pos+mask+1,std::memory_order_release);
+		return true;
+	}
+
+	//a hint only : other threads may push or pop at the same time
+	bool empty()const{
+		const size_t pos = dequeue_pos.load(std::memory_order_acquire);
+		return cells[pos & mask].seq.load(std::memory_order_acquire)!=pos+1;
+	}
+
+private:
+	struct Cell{
+		std::atomic<size_t> seq;
+		T                   data;
+	};
+
+	//producers and consumers positions on different cache lines
+	//(padding rather than alignas : over aligned new needs C++17)
+	std::unique_ptr<Cell[]> cells;
+	size_t                  mask;
+	char                    pad0[64];
+	std::atomic<size_t>     enqueue_pos;
+	char                    pad1[64];
+	std::atomic<size_t>     dequeue_pos;
+	char                    pad2[64];
+};
+
+
+
+}//end namespace mt_impl
+}//end namespace sqlwrapper
+
+
+#endif /* INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_RINGBUFFER_HPP_ */
@@ -0,0 +1,156 @@
+//============================================================================
+// Name        : ThreadPool
+// Author      : Pierre BLAVY
+// Version     : 1.0
+// Copyright   : LGPL 3.0+ : https://www.gnu.org/licenses/lgpl.txt
+// Description : A fixed set of long lived worker threads
+//               - jobs are queued, and run by the first idle worker
+//               - idle workers sleep on a condition variable
+//               - a process wide pool is shared by every parallel function
+//               - the pool grows on demand (reserve), it never shrinks
+//============================================================================
+
+/*
+This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of
+    the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see
+    <https://www.gnu.org/licenses/lgpl-3.0.en.html>.
+*/
+
+
+#ifndef INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_THREADPOOL_HPP_
+#define INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_THREADPOOL_HPP_
+
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+
+
+namespace sqlwrapper{
+namespace mt_impl{
+
+
+struct ThreadPool_t{
+
+	static size_t guess_thread_number(){
+		size_t i = std::thread::hardware_concurrency();
+		if(i<2){i=2;}
+		return i;
+	}
+
+	//the process wide pool, created on first use
+	static ThreadPool_t & global(){
+		static ThreadPool_t pool(guess_thread_number());
+		return pool;
+	}
+
+	//true if the calling thread is a worker of any ThreadPool_t
+	//a job that blocks on other jobs of the same pool may deadlock, use this to run inline instead
+	static bool in_worker(){return worker_flag();}
+
+
+	//reserve() never grows a pool beyond this
+	static size_t guess_max_thread_number(){return 4*guess_thread_number();}
+
+	explicit ThreadPool_t(size_t threads, size_t max_threads=guess_max_thread_number()){
+		if(threads==0){threads=1;}
+		max_size=std::max(threads,max_threads);
+		workers.reserve(threads);
+		for(size_t i = 0; i < threads; ++i){
+			workers.emplace_back([this](){worker_loop();});
+		}
+	}
+
+	~ThreadPool_t(){
+		{
+			std::unique_lock<std::mutex> l(jobs_mutex);
+			stop=true;
+		}
+		jobs_cond.notify_all();
+		std::unique_lock<std::mutex> l(workers_mutex);
+		for(auto &t : workers){t.join();}
+	}
+
+	ThreadPool_t(const ThreadPool_t &)=delete;
+	ThreadPool_t& operator=(const ThreadPool_t &)=delete;
+
+	size_t size(){
+		std::unique_lock<std::mutex> l(workers_mutex);
+		return workers.size();
+	}
+
+	//maximum number of workers
+	size_t max_threads()const{return max_size;}
+
+	//start workers until there are at least threads of them, at most max_threads()
+	//(jobs that wait for each other need as many workers as jobs : keep them below max_threads())
+	void reserve(size_t threads){
+		std::unique_lock<std::mutex> l(workers_mutex);
+		threads=std::min(threads,max_size);
+		while(workers.size()<threads){
+			workers.emplace_back([this](){worker_loop();});
+		}
+	}
+
+	//run job on a worker thread. job must not throw
+	void submit(std::function<void()> job){
+		{
+			std::unique_lock<std::mutex> l(jobs_mutex);
+			jobs.emplace_back(std::move(job));
+		}
+		jobs_cond.notify_one();
+	}
+
+
+private:
+	static bool & worker_flag(){
+		static thread_local bool b=false;
+		return b;
+	}
+
+	void worker_loop(){
+		worker_flag()=true;
+		while(true){
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> l(jobs_mutex);
+				jobs_cond.wait(l,[this]{return stop or !jobs.empty();});
+				if(jobs.empty()){return;} //stop
+				job=std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+
+	size_t                            max_size;
+	std::vector<std::thread>          workers;
+	std::mutex                        workers_mutex;
+	std::deque<std::function<void()>> jobs;
+	std::mutex                        jobs_mutex;
+	std::condition_variable           jobs_cond;
+	bool                              stop=false;
+};
+
+
+
+}//end namespace mt_impl
+}//end namespace sqlwrapper
+
+
+
+#endif /* INCLUDE_SQLWRAPPER_MULTITHREAD_IMPL_MT_THREADPOOL_HPP_ */
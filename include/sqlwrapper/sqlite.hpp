@@ -40,6 +40,9 @@ This program is free software: you can redistribute it and/or modify
 #include <tuple_tools/tuple_function.hpp>
 #include <unicont/deque.hpp>
 #include <unicont/vector.hpp>
+#include <sqlwrapper/mt_impl/mt_JobPool.hpp>
+#include <sqlwrapper/mt_impl/mt_ReorderBuffer.hpp>
+#include <sqlwrapper/mt_impl/mt_Lock.hpp>
 
 //use sqlite3 as DB backend
 #include <sqlite3.h>
@@ -47,10 +50,21 @@ This program is free software: you can redistribute it and/or modify
 
 //standard includes
 #include <cassert>
-#include <mutex>  //Rowid_t is bullshit if db is not locked, and mutex prevent recursive request
+#include <mutex>  //Rowid_t is bullshit if db is not locked, see DbConnectInfo::locking
 #include <atomic> //for savepoints ids
+#include <memory>
 #include <tuple>
 #include <fstream>
+#include <list>          //query cache
+#include <unordered_map> //query cache
+#include <chrono>        //commit policy
+#include <condition_variable> //commit policy timer
+#include <limits>        //pragmas
+#include <cstdio>        //persist
+#include <thread>        //backup
+#include <functional>    //backup
+#include <random>        //busy retry jitter
+#include <cstring>       //checkpointer
 
 
 
@@ -70,6 +84,60 @@ namespace sqlwrapper{
 		explicit DbConnectInfo(const std::string & s):filepath(s){}
 		const std::string filepath;
 
+		//sqlite3_open_v2 flags : https://www.sqlite.org/c3ref/open.html
+		//Threading contract (https://www.sqlite.org/threadsafe.html) :
+		//- Serialized   : sqlite locks the connection in every call. A DbManager may be shared by threads unless locking is None :
+		//                 each DbManager call also runs in a section of the DbManager lock (see locking below), so rows and rowids
+		//                 are consistent. Only locking Shared lets reads of several threads step at the same time.
+		//- Multi_thread : sqlite does not lock the connection. A DbManager, and its Query_t, must be used by one thread at a time
+		//                 (e.g. one connection per thread, or DbPool leases), or with locking Mutex or Spin. This saves a mutex per sqlite call.
+		//- Default      : the mode sqlite was started with (serialized, unless changed by sqlite3_config or at compile time)
+		//In both modes, Query_t, transactions and savepoints must not be shared by threads, and parallel functions
+		//(getApply_parallel...) only use the connection from the calling thread. A library built with SQLITE_THREADSAFE=0 ignores this.
+		enum class Threading{Default, Multi_thread, Serialized};
+		enum class Cache    {Default, Shared, Private};
+
+		bool      read_only=false;              //SQLITE_OPEN_READONLY, else SQLITE_OPEN_READWRITE
+		bool      create   =true;               //SQLITE_OPEN_CREATE : create a missing file (ignored when read_only)
+		bool      uri      =false;              //SQLITE_OPEN_URI : filepath may be a file: URI
+		bool      memory   =false;              //SQLITE_OPEN_MEMORY : filepath names an in memory database
+		Threading threading=Threading::Default; //SQLITE_OPEN_NOMUTEX, SQLITE_OPEN_FULLMUTEX
+		Cache     cache    =Cache::Default;     //SQLITE_OPEN_SHAREDCACHE, SQLITE_OPEN_PRIVATECACHE
+
+		int open_flags()const{
+			int flags = read_only ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+			if(uri   ){flags|=SQLITE_OPEN_URI;}
+			if(memory){flags|=SQLITE_OPEN_MEMORY;}
+			if(threading==Threading::Multi_thread){flags|=SQLITE_OPEN_NOMUTEX;}
+			if(threading==Threading::Serialized  ){flags|=SQLITE_OPEN_FULLMUTEX;}
+			if(cache==Cache::Shared ){flags|=SQLITE_OPEN_SHAREDCACHE;}
+			if(cache==Cache::Private){flags|=SQLITE_OPEN_PRIVATECACHE;}
+			return flags;
+		}
+
+		//Load filepath in memory when the connection is built (sqlite3_serialize, then sqlite3_deserialize) :
+		//queries never read the file after that, and writes stay in memory until DbManager::persist().
+		//A missing file gives an empty database, unless read_only or !create. Needs memory for the whole database.
+		bool memory_image=false;
+
+		//true if the database is not a file (other connections cannot open it)
+		bool in_memory()const{return memory or memory_image or filepath.empty() or filepath==":memory:";}
+
+		//How a DbManager protects the connection and its own state (implicit transaction, query cache, rowids)
+		//every function that uses the connection runs in a section : reads (getRow, getTable, getColumn, getApply...)
+		//are shared, writes (execute, insert..., commit) are exclusive, and transactions and savepoints hold an exclusive
+		//section until they are committed or rolled back. Calls nested in a section of the same thread run in it.
+		//- None   : no lock at all, the DbManager must be used by one thread at a time (see Threading::Multi_thread)
+		//- Mutex  : one thread at a time uses the DbManager
+		//- Spin   : idem, with a spin lock, for short calls and few threads
+		//- Shared : readers run concurrently, writers alone. Concurrent readers call sqlite at the same time : needs Serialized threading
+		//A shared section is never upgraded : a write nested in a read of the same thread (e.g. insertRow from a getApply callback)
+		//runs in the shared section, it is only protected from other writers, not from concurrent readers.
+		//Parallel functions hold the section on the calling thread while they run : fn must not use the DbManager
+		//unless locking is None.
+		typedef mt_impl::Lock_t::Policy Locking;
+		Locking locking=Locking::Mutex;
+
 		template<typename T>
 		struct Limit_t{
 			Limit_t( int sqlite_id_, const T& default_value_, const T &min_value_, const T &max_value_):
@@ -119,6 +187,67 @@ namespace sqlwrapper{
 		//Maximum Number Of Tables In A Schema : unused idem
 
 
+		//performance pragmas, applied when the connection opens, if set : https://www.sqlite.org/pragma.html
+		//DbManager::pragmas() reads back the values in effect (sqlite may ignore some, e.g. page_size of an existing database)
+		enum class Journal_mode{Delete, Truncate, Persist, Memory, Wal, Off};
+		enum class Synchronous {Off=0, Normal=1, Full=2, Extra=3};
+		enum class Temp_store  {Default=0, File=1, Memory=2};
+
+		template<typename T>
+		struct Pragma_t{
+			Pragma_t(const char *name_, const T &min_value_, const T &max_value_):
+				name(name_), min_value(min_value_), max_value(max_value_){}
+
+			void set(const T&t){
+				assert(t>=min_value);
+				assert(t<=max_value);
+				value =t;
+				is_set=true;
+			}
+
+			bool is_set=false;
+			T    value{};
+			const char * const name;
+			const T min_value;
+			const T max_value;
+		};
+
+		Pragma_t<int>          page_size         ={"page_size"         ,512,65536};      //power of two (else DbError_connect), set it before creating tables
+		Pragma_t<Journal_mode> journal_mode      ={"journal_mode"      ,Journal_mode::Delete,Journal_mode::Off};
+		Pragma_t<Synchronous>  synchronous       ={"synchronous"       ,Synchronous::Off,Synchronous::Extra};
+		Pragma_t<int>          cache_size        ={"cache_size"        ,std::numeric_limits<int>::min(),std::numeric_limits<int>::max()}; //pages, or KiB if negative
+		Pragma_t<sqlite3_int64> mmap_size        ={"mmap_size"         ,0,std::numeric_limits<sqlite3_int64>::max()}; //bytes
+		Pragma_t<Temp_store>   temp_store        ={"temp_store"        ,Temp_store::Default,Temp_store::Memory};
+		Pragma_t<int>          threads           ={"threads"           ,0,8};            //auxiliary threads of a statement
+		Pragma_t<int>          wal_autocheckpoint={"wal_autocheckpoint",0,std::numeric_limits<int>::max()}; //pages, 0 disables
+		Pragma_t<int>          busy_timeout      ={"busy_timeout"      ,0,std::numeric_limits<int>::max()}; //milliseconds
+
+
+		//Retry of statements that get SQLITE_BUSY or SQLITE_LOCKED (another connection holds a lock)
+		//every statement run by DbManager sleeps and retries, with an exponential backoff :
+		//first_delay, then doubled up to max_delay, each sleep shortened by a random part of up to jitter of it,
+		//so waiting connections do not retry together. It gives up when it waited max_wait for the statement,
+		//and throws the usual DbError_execute. See DbManager::busy_stats.
+		//Unlike the busy_timeout pragma, this also retries SQLITE_LOCKED (shared cache) and adds jitter.
+		//A deferred transaction that must upgrade its read lock while another connection writes gets SQLITE_BUSY
+		//until it rolls back : retries cannot help, use an immediate transaction.
+		struct Busy_retry{
+			std::chrono::milliseconds max_wait{0};        //0 disables retries
+			std::chrono::microseconds first_delay{100};
+			std::chrono::microseconds max_delay{50000};
+			double                    jitter=0.5;         //in [0,1]
+			bool enabled()const{return max_wait.count()>0;}
+		};
+		Busy_retry busy_retry;
+
+		//prepared statement cache, used by every const Sql_t& overload of DbManager
+		size_t query_cache_size          =64;   //maximum number of cached statements, 0 disables the cache
+		size_t query_cache_max_sql_length=4096; //longer sql are prepared but never cached
+
+		//rows per statement of DbManager::insertTable_batch and insertColumn_batch, also bounded by
+		//max_variable_number and query_cache_max_sql_length (a chunk statement is always cacheable)
+		size_t insert_batch_rows=64;
+
 	};
 
 
@@ -129,6 +258,9 @@ namespace sqlwrapper{
 
 		friend Query_t;
 		friend DbSavepoint_t;
+		friend DbTransaction_t;
+		friend DbBackup_t;
+		friend DbCheckpointer_t;
 
 		explicit DbManager(const DbConnectInfo_t &c);
 		DbManager(DbManager_t &&move_me);
@@ -146,34 +278,94 @@ namespace sqlwrapper{
 		void    prepare(Query_t &target, const Sql_t &sql);
 
 		//make a transaction. Don't forget to create a local transaction object
-		DbTransaction_t transaction();
+		//https://www.sqlite.org/lang_transaction.html
+		//- Deferred  : locks are taken by the first read, then the first write. Upgrading the read lock fails with
+		//              SQLITE_BUSY if another connection writes : reads done so far are lost, and retries cannot help.
+		//- Immediate : takes the write lock at once (busy handler and busy_retry apply), other connections still read.
+		//              Use it for read then write transactions.
+		//- Exclusive : idem, and other connections cannot read either (except in WAL mode, where it is Immediate).
+		enum class Begin_mode{Deferred, Immediate, Exclusive};
+		DbTransaction_t transaction(Begin_mode mode=Begin_mode::Deferred);
 		DbSavepoint_t   savepoint();
 
 
+		//Automatic transaction batching
+		//when a commit policy is set and no transaction is open, writes done by execute(Query_t&,...), insertRow
+		//and every function built on them (insertTuple, insertTable, insertColumn, ..._batch) are grouped in an
+		//implicit transaction, committed every policy.rows rows and/or when it is older than policy.period.
+		//The period is enforced by a timer thread of the DbManager, started by set_commit_policy(), that commits
+		//in a write section : pending rows are committed even if no write follows. With DbConnectInfo::locking None
+		//there is no timer (it could not lock the connection), the period is then only checked after each write.
+		//The implicit transaction is committed before transaction(), savepoint() and execute(string),
+		//by commit_pending(), and on destruction. Other connections do not see pending rows before that.
+		struct Commit_policy{
+			size_t rows=0;                         //commit every rows modified rows, 0 = no row limit
+			std::chrono::milliseconds period{0};   //commit when the transaction is older than period, 0 = no time limit
+			bool enabled()const{return rows!=0 or period.count()!=0;}
+		};
+
+		struct Commit_stats{
+			size_t commits=0;                      //implicit transactions committed
+			size_t rows   =0;                      //rows committed by implicit transactions
+			std::chrono::nanoseconds time{0};      //time spent with an implicit transaction open
+			double rows_per_second()const{return time.count()==0 ? 0 : rows*1e9/time.count();}
+		};
+
+		//commits pending rows, then applies p. It may be called anywhere, also in a transaction or a getApply
+		//callback : the timer is told to read the new period, it is never waited for
+		void          set_commit_policy(const Commit_policy &p);
+		Commit_policy get_commit_policy(){Read_lock db_lock(db_mutex); return commit_policy;}
+		Commit_stats  commit_stats()     {Read_lock db_lock(db_mutex); return commit_stats_;}
+
+		//see DbConnectInfo::busy_retry
+		struct Busy_stats{
+			size_t busy    =0;                     //statements that got SQLITE_BUSY or SQLITE_LOCKED
+			size_t retries =0;                     //sleep then retry
+			size_t failures=0;                     //statements still busy after max_wait
+			std::chrono::nanoseconds wait{0};      //time spent waiting
+		};
+		Busy_stats busy_stats();
+		void          commit_pending(); //commit the implicit transaction, if any
+
+
 		//execute is a general function for sql when we do not care about returned data or Rowid_t, the most performant one
 		//data is automatically bound to the query (if data not empty)
 		                            void execute(const std::string &); //execute (multiple) queries
 		template<typename... data>	void execute(Query_t &query   , data...); //prepare and execute query
-		template<typename... data>	void execute(const Sql_t & sql, data...d){Query_t q=prepare(sql); this->execute(q,d...);}//execute a prepared query
+		template<typename... data>	void execute(const Sql_t & sql, data...d){Cached_query q(*this,sql); this->execute(q.get(),d...);}//execute a prepared query
 
 		//insert a line, reuturn its Rowid_t
 		template<typename... data>	Rowid_t insertRow (Query_t &query  , data...);
-		template<typename... data>	Rowid_t insertRow (const Sql_t &sql, data... d){Query_t q = prepare(sql); return this->insertRow(q,d...);}
+		template<typename... data>	Rowid_t insertRow (const Sql_t &sql, data... d){Cached_query q(*this,sql); return this->insertRow(q.get(),d...);}
 
 		//idem for a tuple
 		template< typename ...Args > void insertTuple(Query_t &query  , const std::tuple<Args...>  &tuple);
-		template< typename ...Args > void insertTuple(const Sql_t &sql, const std::tuple<Args...>  &tuple){Query_t q = prepare(sql); this->insertTuple(q,tuple);}
+		template< typename ...Args > void insertTuple(const Sql_t &sql, const std::tuple<Args...>  &tuple){Cached_query q(*this,sql); this->insertTuple(q.get(),tuple);}
 
 		//idem for a single column
-		template<typename Container> void insertColumn(Query_t &query  , const Container &c){for( const auto &i : c){execute(query,i);}}
-		template<typename Container> void insertColumn(const Sql_t &sql, const Container &c){Query_t q=prepare(sql); this->insertColumn(q,c);}
+		template<typename Container> void insertColumn(Query_t &query  , const Container &c){Write_lock db_lock(db_mutex); for( const auto &i : c){execute(query,i);}}
+		template<typename Container> void insertColumn(const Sql_t &sql, const Container &c){Cached_query q(*this,sql); this->insertColumn(q.get(),c);}
 
 		//idem but insert stuff from a container of tuple
 		template< template <typename...> class Cont, typename ...Args >
 		void insertTable(Query_t &query, const Cont<std::tuple<Args...> >  &data_container);
 
 		template< template <typename...> class Cont, typename ...Args >
-		void insertTable(const Sql_t &sql, const Cont<std::tuple<Args...> >  &data_container){Query_t q = prepare(sql); this->insertTable(q,data_container);}
+		void insertTable(const Sql_t &sql, const Cont<std::tuple<Args...> >  &data_container){Cached_query q(*this,sql); this->insertTable(q.get(),data_container);}
+
+		//idem, but rows are sent by chunks : INSERT ... VALUES (?,?) is rewritten as INSERT ... VALUES (?,?),(?,?),...
+		//chunks have DbConnectInfo::insert_batch_rows rows (fewer if the limits require it), the last rows are inserted one by one.
+		//only one chunk statement per sql is prepared and cached.
+		//sql that cannot be rewritten (INSERT ... SELECT, upsert, trailing comments, named parameters, more than one VALUES keyword...) falls back to the row by row version
+		//note : a failing chunk inserts none of its rows
+		template< template <typename...> class Cont, typename ...Args >
+		void insertTable_batch(Query_t &query, const Cont<std::tuple<Args...> >  &data_container);
+
+		template< template <typename...> class Cont, typename ...Args >
+		void insertTable_batch(const Sql_t &sql, const Cont<std::tuple<Args...> >  &data_container);
+
+		template<typename Container> void insertColumn_batch(Query_t &query  , const Container &c);
+		template<typename Container> void insertColumn_batch(const Sql_t &sql, const Container &c);
 
 
 		///get a single unique line
@@ -181,19 +373,19 @@ namespace sqlwrapper{
 		///    note : use Optional<T> to handle possibly null values
 		//throw if the request do not exactly return 1 row
 		template<typename ...Args >	void  getRow (Query_t &query  , Args &... set_this_values);
-		template<typename ...Args >	void  getRow (const Sql_t &sql, Args &... set_this_values){Query_t q = prepare(sql); this->getRow(q,set_this_values...);}
+		template<typename ...Args >	void  getRow (const Sql_t &sql, Args &... set_this_values){Cached_query q(*this,sql); this->getRow(q.get(),set_this_values...);}
 
 		//idem, but with a line that can be missing. Returns false and do not change values if line is empty
 		template<typename ...Args >	bool  getRow_optional (Query_t &query  , Args &... set_this_values);
-		template<typename ...Args >	bool  getRow_optional (const Sql_t &sql, Args &... set_this_values){Query_t q = prepare(sql); return this->getRow_optional(q,set_this_values...);}
+		template<typename ...Args >	bool  getRow_optional (const Sql_t &sql, Args &... set_this_values){Cached_query q(*this,sql); return this->getRow_optional(q.get(),set_this_values...);}
 
 
 		//idem, for a tuple
 		template< typename ...Args > std::tuple<Args...>  getTuple (Query_t &query)   {std::tuple<Args...> R;getTuple(query,R);return R;}
-		template< typename ...Args > std::tuple<Args...>  getTuple (const Sql_t & sql){Query_t q = prepare(sql);return this->getTuple<Args...>(q);}
+		template< typename ...Args > std::tuple<Args...>  getTuple (const Sql_t & sql){Cached_query q(*this,sql); return this->getTuple<Args...>(q.get());}
 
 		template< typename ...Args > void getTuple (Query_t &query   , std::tuple<Args...> &t);
-		template< typename ...Args > void getTuple (const Sql_t & sql, std::tuple<Args...> &t){Query_t q = prepare(sql);return this->getTuple(q,t);}
+		template< typename ...Args > void getTuple (const Sql_t & sql, std::tuple<Args...> &t){Cached_query q(*this,sql); return this->getTuple(q.get(),t);}
 
 
 
@@ -203,13 +395,13 @@ namespace sqlwrapper{
 		void getTable (Query_t &query,Cont<std::tuple<Args...> > &target);
 
 		template< template <typename...> class Cont, typename ...Args >
-		void getTable (const Sql_t &sql,Cont<std::tuple<Args...> > &target){Query_t q = prepare(sql); this->getTable(q, target);}
+		void getTable (const Sql_t &sql,Cont<std::tuple<Args...> > &target){Cached_query q(*this,sql); this->getTable(q.get(), target);}
 
 		template< template <typename...> class Cont, typename ...Args >
 		Cont<std::tuple<Args...>> getTable(Query_t &query){Cont<std::tuple<Args...>> R; getTable(query,R); return R;}
 
 		template< template <typename...> class Cont, typename ...Args>
-		Cont<std::tuple<Args...>> getTable(const Sql_t &sql){Query_t q = prepare(sql); return this->getTable<Cont,Args...>(q);}
+		Cont<std::tuple<Args...>> getTable(const Sql_t &sql){Cached_query q(*this,sql); return this->getTable<Cont,Args...>(q.get());}
 
 
 
@@ -218,14 +410,14 @@ namespace sqlwrapper{
 		void getColumn(Query_t &q, Cont &append_here, Args ... bind_me );
 
 		template<typename Cont, typename ... Args>
-		void getColumn(const std::string &sql, Cont &append_here, Args ... bind_me ){Query_t q = prepare(sql); this->getColumn(q,append_here,bind_me...);}
+		void getColumn(const std::string &sql, Cont &append_here, Args ... bind_me ){Cached_query q(*this,sql); this->getColumn(q.get(),append_here,bind_me...);}
 
 		//idem but returns a container
 		template<template<typename, typename...> class Cont, typename T,  typename ... Args>
 		Cont<T> getColumn(Query_t &q, Args ... bind_me ){Cont<T> cont;this->getColumn(q,cont,bind_me...);return cont;}
 
 		template<template<typename, typename...> class Cont, typename T,  typename ... Args>
-		Cont<T> getColumn(const std::string &sql, Args ... bind_me ){Query_t q = prepare(sql); return this->getColumn<Cont,T,Args...>(q,bind_me...);}
+		Cont<T> getColumn(const std::string &sql, Args ... bind_me ){Cached_query q(*this,sql); return this->getColumn<Cont,T,Args...>(q.get(),bind_me...);}
 
 
 		//getApply applies a function line by line
@@ -236,9 +428,92 @@ namespace sqlwrapper{
 
 
 		//applied F in parallel
-		//WARNING stuff is popped into a queue without size limit, so the full table may be popped into memory
-		template<typename Fn> auto getApply_parallel(Query_t &query  , Fn fn,const size_t cache_size=128)-> void;
-		template<typename Fn> auto getApply_parallel(const Sql_t &sql, Fn fn,const size_t cache_size=128)-> void;
+		//rows are fetched by pages of cache_size rows, and processed by a pool of worker threads.
+		//memory is bounded : the fetcher waits while options.max_pages pages, or options.max_bytes
+		//estimated bytes (see mt_impl::byte_size) are fetched and not yet processed. With max_bytes, pages are also cut
+		//to their share of it, so stats.peak_bytes<=max_bytes (unless a single row is bigger than a share)
+		typedef mt_impl::JobPool_options Parallel_options;
+		typedef mt_impl::JobPool_stats   Parallel_stats;
+
+		//like getApply, if Fn returns a bool, a false stops the scan : no more page is fetched, rows of fetched pages
+		//are skipped, and getApply_parallel returns false. Rows are processed in parallel, so rows after the stopping
+		//one may already have been processed. options.cancel stops the scan the same way, from any thread.
+		template<typename Fn> auto getApply_parallel(Query_t &query  , Fn fn,const size_t cache_size=128)-> typename tuple_tools::return_type<Fn>::type;
+		template<typename Fn> auto getApply_parallel(const Sql_t &sql, Fn fn,const size_t cache_size=128)-> typename tuple_tools::return_type<Fn>::type;
+		template<typename Fn> auto getApply_parallel(Query_t &query  , Fn fn,const Parallel_options &options)-> typename tuple_tools::return_type<Fn>::type;
+		template<typename Fn> auto getApply_parallel(const Sql_t &sql, Fn fn,const Parallel_options &options)-> typename tuple_tools::return_type<Fn>::type;
+
+		//idem, but keeps the query order : fn(row) runs in parallel, and its results are given to sink
+		//in the order of the rows, by a bounded reorder buffer. sink is never called concurrently.
+		//Fn must return a value R, Sink is like void sink(R &&r). options.steal_chunk is ignored.
+		//if the scan is cancelled (options.cancel) or throws, sink got a prefix of the results
+		template<typename Fn, typename Sink> void getApply_parallel_ordered(Query_t &query  , Fn fn, Sink sink, const Parallel_options &options=Parallel_options());
+		template<typename Fn, typename Sink> void getApply_parallel_ordered(const Sql_t &sql, Fn fn, Sink sink, const Parallel_options &options=Parallel_options());
+
+		//parallel map-reduce : each worker has its own accumulator, starting as a copy of init,
+		//map_fn(acc, row...) is called for each row, then accumulators are merged by merge_fn(target, source)
+		//init must be a neutral element (e.g., 0 for a sum), as it is copied once per worker
+		//ex : auto count = db.getReduce_parallel("select i from t", size_t(0), [](size_t &acc, int i){++acc;}, [](size_t &a, const size_t &b){a+=b;});
+		template<typename Acc, typename Map_fn, typename Merge_fn>
+		Acc getReduce_parallel(Query_t &query  , const Acc &init, Map_fn map_fn, Merge_fn merge_fn, const Parallel_options &options=Parallel_options());
+		template<typename Acc, typename Map_fn, typename Merge_fn>
+		Acc getReduce_parallel(const Sql_t &sql, const Acc &init, Map_fn map_fn, Merge_fn merge_fn, const Parallel_options &options=Parallel_options());
+
+		//fetch -> transform -> write pipeline
+		//fn(row...) runs on the parallel workers and returns the values to write, as a tuple or a single value.
+		//they are bound to write_sql (an insert or an update) by the calling thread, between two fetches,
+		//so the connection is only used by one thread. Results are written in the order pages are processed,
+		//not in the query order. Unless a transaction is open, writes are grouped in implicit transactions
+		//following options.commit (see set_commit_policy). Simple INSERT ... VALUES(?,...) use multi rows inserts.
+		//returns the number of results written
+		//ex : db.getPipeline_parallel("select id, txt from t", [](int id, std::string txt){return std::make_tuple(slow_fn(txt), id);}, "update t set h=? where id=?");
+		struct Pipeline_options : Parallel_options{
+			Commit_policy commit;
+			Pipeline_options(){commit.rows=10000; commit.period=std::chrono::milliseconds(1000);}
+		};
+		template<typename Fn> size_t getPipeline_parallel(Query_t &query  , Fn fn, const Sql_t &write_sql, const Pipeline_options &options=Pipeline_options());
+		template<typename Fn> size_t getPipeline_parallel(const Sql_t &sql, Fn fn, const Sql_t &write_sql, const Pipeline_options &options=Pipeline_options());
+
+		//Partitioned parallel scan
+		//sql must have two parameters, bound to the first and last key of a range, ex :
+		//   "select i,s from test where rowid between ? and ?"
+		//the [min,max] key range of options.table is split in options.partitions ranges, and each range
+		//runs getApply(sql,fn) on its own read only connection to the same file, so both fetching and
+		//processing scale. Use WAL mode to scan while another connection writes.
+		//Rows written by this connection and not yet committed are not seen.
+		//fn is called concurrently and must be thread safe. If fn returns false, its partition stops.
+		//returns false if fn returned false, true otherwise
+		struct Partition_options{
+			Sql_t  table;              //table holding the key
+			Sql_t  key="rowid";        //integer column
+			size_t partitions=0;       //0 = one per worker thread
+		};
+		template<typename Fn> bool getApply_partitioned(const Sql_t &sql, Fn fn, const Partition_options &options);
+
+		const DbConnectInfo_t & get_connect_info()const{return connect_info;}
+
+		//pragmas in effect on this connection (see DbConnectInfo)
+		struct Pragma_values{
+			int                             page_size         =0;
+			DbConnectInfo_t::Journal_mode   journal_mode      =DbConnectInfo_t::Journal_mode::Delete;
+			DbConnectInfo_t::Synchronous    synchronous       =DbConnectInfo_t::Synchronous::Full;
+			int                             cache_size        =0;
+			sqlite3_int64                   mmap_size         =0;
+			DbConnectInfo_t::Temp_store     temp_store        =DbConnectInfo_t::Temp_store::Default;
+			int                             threads           =0;
+			int                             wal_autocheckpoint=0;
+			int                             busy_timeout      =0;
+		};
+		Pragma_values pragmas();
+
+		//write the database to path, e.g. to save a memory_image. An empty path means the connect_info file, and is only
+		//allowed for a memory_image (for other connections it is the file being written) : DbError_file otherwise.
+		//It is copied with the backup API to path-tmp, that is renamed to path : path is always either the
+		//old or the new database. path must not be open by another connection.
+		void persist(const std::string &path=std::string());
+
+		//statistics of the last parallel function that ran on this connection
+		Parallel_stats parallel_stats();
 
 
 		//Read a sql file, and execute it.
@@ -255,12 +530,23 @@ namespace sqlwrapper{
 		Cont<Column_info_t>  getColumn_info(Query_t &q, Args ... bind_me );
 
 		template<template<typename, typename...> class Cont, typename ... Args>
-		Cont<Column_info_t> getColumn_info(const std::string &sql, Args ... bind_me ){Query_t q = prepare(sql); return this->getColumn_info<Cont,Args...>(q,bind_me...);}
+		Cont<Column_info_t> getColumn_info(const std::string &sql, Args ... bind_me ){Cached_query q(*this,sql); return this->getColumn_info<Cont,Args...>(q.get(),bind_me...);}
 
 
 
 
 
+		//prepared statement cache statistics, see DbConnectInfo::query_cache_size
+		struct Query_cache_stats{
+			size_t hit    =0; //statement reused
+			size_t miss   =0; //statement prepared
+			size_t evicted=0; //statement finalized to make room
+			size_t size   =0; //number of cached statements
+		};
+		Query_cache_stats query_cache_stats();
+		void              query_cache_clear(); //finalize every cached statement that is not in use
+
+
 		private:
 		struct Query_guard;
 		//struct Tuple_bind_r;
@@ -291,46 +577,176 @@ namespace sqlwrapper{
 			Query_t &query;
 		};
 
-		//apply helpers
-		template<typename T> struct GetData_apply;
-
-		template<typename... Args>
-		struct GetData_apply<std::tuple<Args...> >{
-			GetData_apply(Query_t &q);
-			std::tuple<Args...> get_data();//if have data, get it!
-			bool have_data()const;
-
-			private:
-			mutable int querry_result;                 //initialize on first use
-			Tuple_setFrom_r fn;
-			bool have_data_b=true;
-			Query_t &query;
+		//reduce helper : call fn(acc, row...) from a row tuple
+		template<typename Fn, typename Acc>
+		struct Reduce_bind{
+			Fn  &fn;
+			Acc &acc;
+			template<typename... Row> void operator()(Row&... row){fn(acc,row...);}
 		};
 
-
-
 		//apply an function object to each row.
 		//the function object must return true to continue fetching data
 		//if false is returned, fetching data stops and false is returned
 		template<typename Fn> bool getApply_bool(Query_t &query  , Fn fn);
-		template<typename Fn> bool getApply_bool(const Sql_t &sql, Fn fn){Query_t q=prepare(sql); return this->getApply_bool<Fn>(q,fn);}
+		template<typename Fn> bool getApply_bool(const Sql_t &sql, Fn fn){Cached_query q(*this,sql); return this->getApply_bool<Fn>(q.get(),fn);}
 
 		//idem but with a function that returns void
 		//the function is applyed anyway
 		template<typename Fn> void getApply_void(Query_t &query  , Fn fn);
-		template<typename Fn> void getApply_void(const Sql_t &sql, Fn fn){Query_t q=prepare(sql); this->getApply_void<Fn>(q,fn);}
+		template<typename Fn> void getApply_void(const Sql_t &sql, Fn fn){Cached_query q(*this,sql); this->getApply_void<Fn>(q.get(),fn);}
+
+		//batch insert helpers
+		struct Batch_sql{
+			Sql_t  head;       //INSERT ... VALUES
+			Sql_t  row;        //(?,?)
+			Sql_t  tail;       //trailing ; and spaces
+			size_t row_params=0;
+		};
+		static bool  batch_split(const Sql_t &sql, Batch_sql &target); //false if sql cannot be rewritten
+		static Sql_t batch_sql  (const Batch_sql &b, size_t rows);
+		size_t       batch_rows (const Batch_sql &b);                  //rows per chunk
+
+		template<typename It, typename Bind_fn>
+		bool insert_batch(const Sql_t &sql, It begin, It end, Bind_fn bind_row); //false if not batchable
+
+		//run fn on a partition, tell if it went to the end
+		template<typename Fn> static bool partition_apply(DbManager_t &db, Query_t &q, Fn &fn, std::true_type  /*fn returns bool*/){return db.getApply(q,fn);}
+		template<typename Fn> static bool partition_apply(DbManager_t &db, Query_t &q, Fn &fn, std::false_type /*fn returns void*/){db.getApply(q,fn); return true;}
+
+		//common part of parallel functions : fetch pages of Tuple_t from query, run process_fn(Page &) on them in parallel
+		//before_fetch() runs on the calling thread, with the connection, before each page is fetched
+		struct No_hook{void operator()()const{}};
+		template<typename Tuple_t, typename Process_t, typename Hook_t=No_hook>
+		Parallel_stats parallel_run(Query_t &query, Process_t process_fn, const Parallel_options &options, Hook_t before_fetch=Hook_t());
+
+		//pipeline : bind a result of fn to the write query
+		template<typename... Args> static void bind_result(Query_t &q, const std::tuple<Args...> &t);
+		template<typename T>       static void bind_result(Query_t &q, const T &t);
+
+		//apply fn to a row in getApply_parallel, tell if the scan goes on
+		template<typename Fn, typename Tuple_t> static bool parallel_apply(Fn &fn, Tuple_t &t, std::true_type  /*fn returns bool*/){return tuple_tools::tuple_function(fn,t);}
+		template<typename Fn, typename Tuple_t> static bool parallel_apply(Fn &fn, Tuple_t &t, std::false_type /*fn returns void*/){tuple_tools::tuple_function(fn,t); return true;}
 
 		template<bool return_bool>        struct getApply_dispatch;
 		template<bool return_bool> friend class  getApply_dispatch;
 
-		//Savepoint stuff
-		typedef Sql_t Savepoint_id_t;
-		Savepoint_id_t savepoint_newid(){return "s"+std::to_string(savepoint_id++);}
+		//called by the constructor
+		void apply_pragmas(const DbConnectInfo_t &d);
+		void load_image   (const DbConnectInfo_t &d); //see DbConnectInfo::memory_image
+
+		//Transaction and savepoint stuff
+		//control statements are prepared once per connection, and reused. Savepoint names s0, s1... come from
+		//a pool : a name is given back when its savepoint is done, so a few names (and statements) are enough.
+		//Called in the exclusive section held by DbTransaction and DbSavepoint
+		typedef size_t Savepoint_id_t;
+		struct Control_queries{
+			struct Savepoint{
+				std::unique_ptr<Query_t> open;     //SAVEPOINT sN
+				std::unique_ptr<Query_t> release;  //RELEASE sN
+				std::unique_ptr<Query_t> rollback; //ROLLBACK TO sN
+			};
+			std::unique_ptr<Query_t>    begin[3]; //see Begin_mode
+			std::unique_ptr<Query_t>    commit;
+			std::unique_ptr<Query_t>    rollback;
+			std::vector<Savepoint>      savepoints; //index = Savepoint_id_t
+			std::vector<Savepoint_id_t> free_savepoints;
+		};
+		Query_t & control_query(std::unique_ptr<Query_t> &q, const char *sql); //prepare q on first use
+		int       control_step (Query_t &q); //run q, returns SQLITE_OK or the error
+		void      control      (Query_t &q); //idem, throw DbError_execute
+
+		void           begin   (Begin_mode mode);
+		void           commit  ();
+		void           rollback();
+		Savepoint_id_t savepoint_open    ();
+		void           savepoint_release (Savepoint_id_t id);
+		void           savepoint_rollback(Savepoint_id_t id);
+		void           savepoint_free    (Savepoint_id_t id){control_queries.free_savepoints.push_back(id);}
+
+		//LRU cache of prepared statements, keyed by sql text
+		//entries used by a Cached_query are never evicted, a second user of the same sql gets a private statement
+		struct Query_cache{
+			struct Entry{
+				Entry(const Sql_t &s, std::unique_ptr<Query_t> &&q):sql(s),query(std::move(q)){}
+				const Sql_t sql;
+				std::unique_ptr<Query_t> query; //Query_t is incomplete here
+				bool        in_use=false;
+			};
+			typedef std::list<Entry> List_t;
+
+			List_t lru; //most recently used first
+			std::unordered_map<Sql_t,List_t::iterator> index;
+			size_t max_size      =0;
+			size_t max_sql_length=0;
+			Query_cache_stats stats;
+		};
+
+		//RAII helper : borrow a query from the cache (prepare it if needed), give it back on destruction
+		struct Cached_query{
+			Cached_query(DbManager_t &db_, const Sql_t &sql);
+			~Cached_query();
+			Cached_query(const Cached_query &)=delete;
+			Cached_query& operator=(const Cached_query &)=delete;
+			Query_t & get(){return *query;}
+
+			private:
+			DbManager_t &db;
+			Query_cache::List_t::iterator entry;
+			bool     cached=false;
+			std::unique_ptr<Query_t> own; //used when the statement is not cached
+			Query_t *query=nullptr;
+		};
+		friend Cached_query;
+
+		void query_cache_evict(); //called with cache_mutex locked
+
+		//sections on db_mutex, see DbConnectInfo::locking
+		typedef mt_impl::Lock_guard_t<true>  Read_lock;
+		typedef mt_impl::Lock_guard_t<false> Write_lock;
+		static mt_impl::Lock_t::Policy cache_locking(mt_impl::Lock_t::Policy p){return p==mt_impl::Lock_t::Policy::Shared ? mt_impl::Lock_t::Policy::Mutex : p;}
+
+		//commit policy helpers
+		struct Commit_batch{
+			bool   open=false; //an implicit transaction is open
+			size_t rows=0;
+			std::chrono::steady_clock::time_point begin;
+		};
+		void autocommit_begin(Query_t &query); //open an implicit transaction before a write, if needed
+		void autocommit_add  ();               //count modified rows, commit if the policy is reached
+		void autocommit_abort();               //after an error : keep autocommit semantic for previous rows
+		void commit_timer_start();             //if the policy has a period, or wake the running timer, see Commit_policy
+		void commit_timer_stop ();             //never call it in a section of db_mutex : the timer locks it
+		void commit_timer_run  ();
+
+		//every statement runs with these, to apply connect_info.busy_retry
+		int step(sqlite3_stmt *s){
+			const int rc = sqlite3_step(s);
+			if((rc&0xff)!=SQLITE_BUSY and (rc&0xff)!=SQLITE_LOCKED){return rc;}
+			return step_busy(s,rc);
+		}
+		int step_busy(sqlite3_stmt *s, int rc);
+		int exec(const char *sql); //like sqlite3_exec(db,sql,NULL,0,NULL), for one or several statements
 
 		private:
+		DbConnectInfo_t connect_info;
 		sqlite3 *db;
-		std::mutex db_mutex;
-		std::atomic<size_t> savepoint_id;
+		mt_impl::Lock_t db_mutex;
+		mt_impl::Lock_t cache_mutex;
+		Query_cache query_cache;
+		std::mutex     parallel_stats_mutex;
+		Parallel_stats parallel_stats_;
+		Commit_policy commit_policy;
+		Commit_batch  commit_batch;
+		Commit_stats  commit_stats_;
+		std::thread             commit_timer;
+		std::mutex              commit_timer_mutex;
+		std::condition_variable commit_timer_cond;
+		bool                    commit_timer_stopping=false;
+		bool                    commit_timer_reload  =false;
+		std::mutex    busy_stats_mutex;
+		Busy_stats    busy_stats_;
+		Control_queries control_queries;
 	};
 
 
@@ -403,7 +819,7 @@ namespace sqlwrapper{
 	//---- DbTransaction ---
 	template<>
 	struct DbTransaction<Sqlite_tag>{
-		explicit DbTransaction(DbManager<Sqlite_tag> &db_);
+		explicit DbTransaction(DbManager<Sqlite_tag> &db_, DbManager<Sqlite_tag>::Begin_mode mode=DbManager<Sqlite_tag>::Begin_mode::Deferred);
 		         DbTransaction(DbTransaction<Sqlite_tag> &&s);
 		         ~DbTransaction();
 
@@ -417,6 +833,7 @@ namespace sqlwrapper{
 		private:
 		bool done=false;
 		DbManager<Sqlite_tag> &db;
+		mt_impl::Lock_guard_t<false> db_lock; //other threads wait until commit or rollback
 	};
 
 
@@ -441,6 +858,194 @@ namespace sqlwrapper{
 		bool done=false;
 		DbManager<Sqlite_tag> ::Savepoint_id_t savepoint_id;
 		DbManager<Sqlite_tag>  &db;
+		mt_impl::Lock_guard_t<false> db_lock; //other threads wait until release or rollback
+	};
+
+
+
+
+	//---- DbPool ---
+	//One writer and N reader connections to the same database file, in WAL mode :
+	//readers do not wait for each other, nor for the writer, and writes stay serialized.
+	//A Lease gives a connection (use it like a DbManager : lease->getRow(...)), and gives it back to the pool on destruction.
+	//reader() waits while every reader is leased, writer() while the writer is. A connection is used by
+	//one lease at a time, so a lease must stay in one thread at a time, and must not outlive the pool.
+	//Readers are read only and see the last committed state : uncommitted writes of the writer are not seen.
+	//As a connection is used by one thread at a time, DbConnectInfo::Threading::Multi_thread is safe here.
+	template<>
+	struct DbPool<Sqlite_tag>{
+		SQLWRAPPER_TYPES(Sqlite_tag);
+
+		struct Lease{
+			Lease(Lease &&l);
+			~Lease();
+			Lease(const Lease &)=delete;
+			Lease& operator=(const Lease &)=delete;
+
+			DbManager_t & operator* ()const{return *db;}
+			DbManager_t * operator->()const{return  db;}
+			DbManager_t & get()       const{return *db;}
+
+			private:
+			friend DbPool_t;
+			Lease(DbPool_t &pool_, DbManager_t &db_, bool writer_):pool(&pool_),db(&db_),writer(writer_){}
+			DbPool_t    *pool;
+			DbManager_t *db;
+			bool         writer;
+		};
+
+		struct Stats{
+			size_t reader_leases=0;
+			size_t writer_leases=0;
+			size_t reader_waits =0; //leases that had to wait for a connection
+			size_t writer_waits =0;
+		};
+
+		//readers=0 : one reader per hardware thread
+		explicit DbPool(const DbConnectInfo_t &c, size_t readers=0);
+		~DbPool();
+		DbPool(const DbPool_t &)=delete;
+		DbPool_t& operator=(const DbPool_t &)=delete;
+
+		Lease reader();
+		Lease writer();
+
+		size_t reader_count()const{return readers.size();}
+		Stats  stats();
+
+		private:
+		void give_back(DbManager_t *db, bool writer);
+
+		std::unique_ptr<DbManager_t>              writer_db;
+		std::vector<std::unique_ptr<DbManager_t>> readers;
+		std::vector<DbManager_t*>                 free_readers;
+		bool                                      writer_free=true;
+		Stats                                     stats_;
+		std::mutex                                mutex;
+		std::condition_variable                   cond;
+	};
+
+
+
+
+	//---- DbBackup ---
+	//Online backup of a live database to a file (https://www.sqlite.org/backup.html) :
+	//a background thread copies options.pages_per_step pages at a time, and sleeps options.pause between steps,
+	//so the source connection and other writers are only locked during a step. Pages modified during the backup
+	//are copied again. The copy is written to path-tmp, and renamed to path when it is complete.
+	//Each step runs in a read section of the source DbManager (see DbConnectInfo::locking) : with Locking::None
+	//the source must not be used until the backup is finished.
+	//ex : DbBackup_t b(db,"snapshot.sqlite3"); ... b.wait();
+	template<>
+	struct DbBackup<Sqlite_tag>{
+		SQLWRAPPER_TYPES(Sqlite_tag);
+
+		struct Progress{
+			int    remaining=0;                //pages left to copy
+			int    pagecount=0;                //pages of the source
+			size_t steps    =0;
+			size_t busy     =0;                //steps that found the source locked
+			std::chrono::nanoseconds elapsed{0};
+			bool   finished =false;            //done, failed or cancelled
+			double done()const{return pagecount==0 ? 0 : 1.0-double(remaining)/pagecount;}
+		};
+
+		struct Options{
+			int pages_per_step;                             //pages copied per step, -1 copies everything in one step
+			std::chrono::milliseconds pause;                //sleep between steps (throttling)
+			std::function<void(const Progress &)> progress; //called on the backup thread after each step, must not throw
+			Options():pages_per_step(64),pause(10){}
+		};
+
+		DbBackup(DbManager_t &source, const std::string &path, const Options &options=Options());
+		~DbBackup(); //cancel and wait
+		DbBackup(const DbBackup_t &)=delete;
+		DbBackup_t& operator=(const DbBackup_t &)=delete;
+
+		void     wait();     //wait the end of the backup, throw DbError_file if it failed
+		void     cancel();   //stop as soon as possible, path is not changed
+		Progress progress();
+
+		private:
+		void run();
+		bool pause(); //false if cancelled
+
+		DbManager_t            &source;
+		const std::string       path;
+		const Options           options;
+		Progress                progress_;
+		bool                    cancelled=false;
+		std::exception_ptr      error;
+		std::mutex              mutex;
+		std::condition_variable cond;
+		std::thread             thread; //last : starts once every other member is built
+	};
+
+
+
+
+	//---- DbCheckpointer ---
+	//Background WAL checkpoints (https://www.sqlite.org/wal.html#ckpt) for a DbManager in WAL mode.
+	//A wal hook on the DbManager reads the WAL size after each commit, and a background thread checkpoints
+	//with its own connection, so commits never run a checkpoint. The checkpoint mode grows with the WAL size :
+	//- PASSIVE  : copies what it can without waiting, long readers may keep the WAL growing
+	//- RESTART  : also waits (policy.busy_timeout) for readers, so next writers restart at the beginning of the WAL.
+	//             Writers are blocked meanwhile : give them a busy_timeout or a busy_retry longer than policy.busy_timeout
+	//- TRUNCATE : idem, and truncates the WAL file to 0 bytes
+	//The hook replaces the automatic checkpoint of the DbManager (wal_autocheckpoint), that is restored on destruction.
+	//The DbCheckpointer must not outlive the DbManager.
+	template<>
+	struct DbCheckpointer<Sqlite_tag>{
+		SQLWRAPPER_TYPES(Sqlite_tag);
+
+		enum class Mode{Passive, Restart, Truncate};
+
+		struct Policy{
+			int passive_pages;                //checkpoint when the WAL has passive_pages pages or more
+			int restart_pages;                //RESTART when the WAL has restart_pages pages or more, 0 = never
+			int truncate_pages;               //TRUNCATE when the WAL has truncate_pages pages or more, 0 = never
+			std::chrono::milliseconds period; //also run a PASSIVE checkpoint every period, 0 = only after commits
+			std::chrono::milliseconds busy_timeout; //RESTART and TRUNCATE wait that long for readers and writers
+			Policy():passive_pages(1000),restart_pages(10000),truncate_pages(0),period(0),busy_timeout(100){}
+		};
+
+		struct Stats{
+			size_t checkpoints=0;
+			size_t passive    =0;
+			size_t restart    =0;
+			size_t truncate   =0;
+			size_t busy       =0;              //checkpoints that could not finish (SQLITE_BUSY, or an error)
+			int    wal_pages  =0;              //WAL size seen by the last commit
+			int    last_log   =0;              //WAL pages, and pages copied to the database, by the last checkpoint
+			int    last_copied=0;
+			std::chrono::nanoseconds last_time {0};
+			std::chrono::nanoseconds total_time{0};
+			std::chrono::nanoseconds max_time  {0};
+		};
+
+		explicit DbCheckpointer(DbManager_t &db, const Policy &policy=Policy());
+		~DbCheckpointer();
+		DbCheckpointer(const DbCheckpointer_t &)=delete;
+		DbCheckpointer_t& operator=(const DbCheckpointer_t &)=delete;
+
+		void  request(Mode m=Mode::Passive); //checkpoint as soon as possible
+		Stats stats();
+
+		private:
+		static int wal_hook(void *self, sqlite3 *db, const char *name, int pages);
+		void run();
+		int  checkpoint(Mode m); //returns the sqlite error code
+
+		DbManager_t            &source;
+		const Policy            policy;
+		sqlite3                *connection=nullptr;
+		bool                    pending=false;
+		Mode                    pending_mode=Mode::Passive;
+		bool                    stop=false;
+		Stats                   stats_;
+		std::mutex              mutex;
+		std::condition_variable cond;
+		std::thread             thread;
 	};
 
 
@@ -454,6 +1059,9 @@ namespace sqlwrapper{
 #include <sqlwrapper/sqlite_impl/Query.tpp>
 #include <sqlwrapper/sqlite_impl/DbSavepoint.tpp>
 #include <sqlwrapper/sqlite_impl/DbTransaction.tpp>
+#include <sqlwrapper/sqlite_impl/DbPool.tpp>
+#include <sqlwrapper/sqlite_impl/DbBackup.tpp>
+#include <sqlwrapper/sqlite_impl/DbCheckpointer.tpp>
 #include <sqlwrapper/sqlite_impl/Types_base.tpp>
 
 #endif /* SQLWRAPPER_SQLITE_HPP_ */
@@ -0,0 +1,114 @@
+#ifndef INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBBACKUP_TPP_
+#define INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBBACKUP_TPP_
+
+namespace sqlwrapper{
+
+
+
+		inline DbBackup<Sqlite_tag>::DbBackup(DbManager_t &source_, const std::string &path_, const Options &options_):
+			source(source_),
+			path(path_),
+			options(options_)
+		{
+			source.commit_pending(); //rows of the implicit transaction are part of the backup
+			thread=std::thread([this]{run();});
+		}
+
+		inline DbBackup<Sqlite_tag>::~DbBackup(){
+			cancel();
+			if(thread.joinable()){thread.join();}
+		}
+
+		inline void DbBackup<Sqlite_tag>::wait(){
+			if(thread.joinable()){thread.join();}
+			std::unique_lock<std::mutex> l(mutex);
+			if(error){
+				auto e = error;
+				error=nullptr; //throw once
+				std::rethrow_exception(e);
+			}
+		}
+
+		inline void DbBackup<Sqlite_tag>::cancel(){
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				cancelled=true;
+			}
+			cond.notify_all();
+		}
+
+		inline auto DbBackup<Sqlite_tag>::progress()->Progress{
+			std::unique_lock<std::mutex> l(mutex);
+			return progress_;
+		}
+
+		inline bool DbBackup<Sqlite_tag>::pause(){
+			std::unique_lock<std::mutex> l(mutex);
+			cond.wait_for(l,options.pause,[this]{return cancelled;});
+			return !cancelled;
+		}
+
+
+		inline void DbBackup<Sqlite_tag>::run(){
+			const auto        begin = std::chrono::steady_clock::now();
+			const std::string tmp   = path + "-tmp";
+			sqlite3        *target = nullptr;
+			sqlite3_backup *backup = nullptr;
+			int  rc      = SQLITE_OK;
+			bool complete= false;
+
+			std::remove(tmp.c_str());
+			rc = sqlite3_open_v2(tmp.c_str(), &target, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+			if(rc==SQLITE_OK){
+				DbManager_t::Read_lock db_lock(source.db_mutex);
+				backup = sqlite3_backup_init(target, "main", source.db, "main");
+				if(backup==nullptr){rc=sqlite3_errcode(target);}
+			}
+
+			while(backup!=nullptr){
+				Progress p;
+				{
+					DbManager_t::Read_lock db_lock(source.db_mutex);
+					rc = sqlite3_backup_step(backup, options.pages_per_step);
+					p.remaining=sqlite3_backup_remaining(backup);
+					p.pagecount=sqlite3_backup_pagecount(backup);
+				}
+				{
+					std::unique_lock<std::mutex> l(mutex);
+					p.steps  =progress_.steps+1;
+					p.busy   =progress_.busy + (rc==SQLITE_BUSY or rc==SQLITE_LOCKED);
+					p.elapsed=std::chrono::steady_clock::now()-begin;
+					progress_=p;
+				}
+				if(options.progress){options.progress(p);}
+
+				if(rc==SQLITE_DONE){complete=true; break;}
+				if(rc!=SQLITE_OK and rc!=SQLITE_BUSY and rc!=SQLITE_LOCKED){break;}
+				if(!pause()){break;}
+			}
+
+			if(backup!=nullptr){
+				DbManager_t::Read_lock db_lock(source.db_mutex);
+				sqlite3_backup_finish(backup);
+			}
+			const std::string msg = target==nullptr ? "out of memory" : sqlite3_errmsg(target);
+			sqlite3_close_v2(target);
+
+			bool renamed = complete and std::rename(tmp.c_str(), path.c_str())==0;
+			if(!renamed){std::remove(tmp.c_str());}
+
+			std::unique_lock<std::mutex> l(mutex);
+			progress_.finished=true;
+			progress_.elapsed =std::chrono::steady_clock::now()-begin;
+			if(complete and !renamed){
+				error=std::make_exception_ptr(DbError_file("sqlite : backup done, but rename failed. File=" + path));
+			}else if(!complete and !cancelled){
+				error=std::make_exception_ptr(DbError_file("sqlite : backup failed. File=" + path + ", error=" + std::to_string(rc) + ", msg=" + msg));
+			}
+		}
+
+
+
+}//end namespace sqlwrapper
+
+#endif
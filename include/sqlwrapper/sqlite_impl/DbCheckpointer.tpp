@@ -0,0 +1,133 @@
+#ifndef INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBCHECKPOINTER_TPP_
+#define INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBCHECKPOINTER_TPP_
+
+namespace sqlwrapper{
+
+
+
+		inline DbCheckpointer<Sqlite_tag>::DbCheckpointer(DbManager_t &db_, const Policy &policy_):
+			source(db_),
+			policy(policy_)
+		{
+			const DbConnectInfo_t &info = source.get_connect_info();
+			if(info.in_memory()){
+				throw DbError_connect("sqlite : checkpoints need a database file, file=" + info.filepath);
+			}
+			std::string mode;
+			source.getRow("PRAGMA journal_mode",mode);
+			for(auto &c : mode){c=std::tolower(static_cast<unsigned char>(c));}
+			if(mode!="wal"){
+				throw DbError_connect("sqlite : checkpoints need WAL mode, journal_mode=" + mode + ", file=" + info.filepath);
+			}
+
+			int rc = sqlite3_open_v2(info.filepath.c_str(), &connection, SQLITE_OPEN_READWRITE | (info.uri ? SQLITE_OPEN_URI : 0), nullptr);
+			if(rc!=SQLITE_OK){
+				const std::string msg = connection==nullptr ? "out of memory" : sqlite3_errmsg(connection);
+				sqlite3_close_v2(connection);
+				throw DbError_connect("sqlite : cannot open the checkpoint connection. File=" + info.filepath + ", error=" + std::to_string(rc) + ", msg=" + msg);
+			}
+			sqlite3_busy_timeout(connection, static_cast<int>(policy.busy_timeout.count()));
+			sqlite3_exec(connection, "PRAGMA journal_mode", NULL, 0, NULL); //reads the header : the connection knows it is in WAL mode
+
+			thread=std::thread([this]{run();});
+
+			DbManager_t::Write_lock db_lock(source.db_mutex);
+			sqlite3_wal_hook(source.db, &DbCheckpointer_t::wal_hook, this);
+		}
+
+		inline DbCheckpointer<Sqlite_tag>::~DbCheckpointer(){
+			{
+				//give back the automatic checkpoint, that also removes the hook
+				DbManager_t::Write_lock db_lock(source.db_mutex);
+				const DbConnectInfo_t &info = source.get_connect_info();
+				sqlite3_wal_autocheckpoint(source.db, info.wal_autocheckpoint.is_set ? info.wal_autocheckpoint.value : 1000);
+			}
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				stop=true;
+			}
+			cond.notify_all();
+			thread.join();
+			sqlite3_close_v2(connection);
+		}
+
+		inline void DbCheckpointer<Sqlite_tag>::request(Mode m){
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				if(!pending or pending_mode<m){pending_mode=m;}
+				pending=true;
+			}
+			cond.notify_all();
+		}
+
+		inline auto DbCheckpointer<Sqlite_tag>::stats()->Stats{
+			std::unique_lock<std::mutex> l(mutex);
+			return stats_;
+		}
+
+
+		//called after each commit of the DbManager, by the committing thread : keep it short
+		inline int DbCheckpointer<Sqlite_tag>::wal_hook(void *self, sqlite3 *, const char *name, int pages){
+			if(std::strcmp(name,"main")!=0){return SQLITE_OK;} //attached databases are not handled
+			DbCheckpointer_t &c = *static_cast<DbCheckpointer_t*>(self);
+			const Policy     &p = c.policy;
+
+			Mode m = Mode::Passive;
+			if     (p.truncate_pages!=0 and pages>=p.truncate_pages){m=Mode::Truncate;}
+			else if(p.restart_pages !=0 and pages>=p.restart_pages ){m=Mode::Restart;}
+			{
+				std::unique_lock<std::mutex> l(c.mutex);
+				c.stats_.wal_pages=pages;
+				if(pages<p.passive_pages){return SQLITE_OK;}
+				if(!c.pending or c.pending_mode<m){c.pending_mode=m;}
+				c.pending=true;
+			}
+			c.cond.notify_all();
+			return SQLITE_OK;
+		}
+
+
+		inline void DbCheckpointer<Sqlite_tag>::run(){
+			std::unique_lock<std::mutex> l(mutex);
+			auto ready=[this]{return stop or pending;};
+			while(true){
+				if(policy.period.count()==0){cond.wait(l,ready);}
+				else if(!cond.wait_for(l,policy.period,ready)){pending=true; pending_mode=Mode::Passive;}
+				if(stop){return;}
+
+				const Mode m = pending_mode;
+				pending=false;
+				l.unlock();
+				checkpoint(m);
+				l.lock();
+			}
+		}
+
+		inline int DbCheckpointer<Sqlite_tag>::checkpoint(Mode m){
+			const int modes[]={SQLITE_CHECKPOINT_PASSIVE,SQLITE_CHECKPOINT_RESTART,SQLITE_CHECKPOINT_TRUNCATE};
+			int log   =0;
+			int copied=0;
+			const auto begin = std::chrono::steady_clock::now();
+			const int  rc    = sqlite3_wal_checkpoint_v2(connection, "main", modes[static_cast<int>(m)], &log, &copied);
+			const auto time  = std::chrono::steady_clock::now()-begin;
+
+			std::unique_lock<std::mutex> l(mutex);
+			Stats &s = stats_;
+			++s.checkpoints;
+			if(m==Mode::Passive ){++s.passive;}
+			if(m==Mode::Restart ){++s.restart;}
+			if(m==Mode::Truncate){++s.truncate;}
+			if(rc!=SQLITE_OK){++s.busy;}
+			s.last_log   =log;
+			s.last_copied=copied;
+			s.last_time  =time;
+			s.total_time+=time;
+			s.max_time   =std::max<std::chrono::nanoseconds>(s.max_time,time);
+			return rc;
+		}
+
+
+
+}//end namespace sqlwrapper
+
+#endif
@@ -3,7 +3,9 @@
 #include <atomic>
 #include <thread>
 #include <sstream>
-#include "../mt_impl/mt_JobPool.hpp"
+#include <cctype>    //batch insert sql parsing
+#include <algorithm>
+#include <limits>
 
 namespace sqlwrapper{
 
@@ -29,27 +31,74 @@ namespace sqlwrapper{
 
 	}
 
+	namespace mt_impl{
+		template<typename T>
+		struct Byte_size_t<Optional<T> >{
+			static size_t heap(const Optional<T>&t){return byte_size_heap(t.second);}
+		};
+	}
 
 
 
-	inline DbManager<Sqlite_tag>::DbManager(DbManager_t &&move_me){
+
+	inline DbManager<Sqlite_tag>::DbManager(DbManager_t &&move_me):
+		connect_info(move_me.connect_info),
+		db_mutex(move_me.db_mutex.policy()),
+		cache_mutex(move_me.cache_mutex.policy())
+	{
+		move_me.commit_timer_stop(); //it runs on move_me
 		move_me.db_mutex.lock();
 		db=move_me.db;
 		move_me.db=nullptr;
-		savepoint_id .store(  move_me.savepoint_id);
+		control_queries=std::move(move_me.control_queries);
+		move_me.cache_mutex.lock();
+		query_cache=std::move(move_me.query_cache);
+		move_me.cache_mutex.unlock();
+		commit_policy=move_me.commit_policy;
+		commit_batch =move_me.commit_batch;
+		commit_stats_=move_me.commit_stats_;
+		move_me.commit_batch.open=false;
 		move_me.db_mutex.unlock();
+		commit_timer_start();
 	}
 
 
 	inline DbManager<Sqlite_tag>::~DbManager(){
+		commit_timer_stop();
 		if(db==nullptr){return;}
+		if(commit_batch.open){sqlite3_exec(db,"COMMIT",NULL,0,NULL);}
+		query_cache.index.clear();
+		query_cache.lru.clear(); //finalize cached statements before closing
+		control_queries=Control_queries();
 		auto status = sqlite3_close_v2(db);
 		if(status != SQLITE_OK){throw DbError("sqlite : error when closing sqlite3 connection, error=" + std::to_string(status) );}
 	}
 
-	inline DbManager<Sqlite_tag>::DbManager(const DbConnectInfo_t &d):db(nullptr),savepoint_id(0){
-		int rc = sqlite3_open(d.filepath.c_str(), &db);
-		if(rc!= SQLITE_OK){throw DbError_connect("sqlite : cannot init. File=" + d.filepath + ", error=" + std::to_string(rc));}
+	inline DbManager<Sqlite_tag>::DbManager(const DbConnectInfo_t &d):connect_info(d),db(nullptr),db_mutex(d.locking),cache_mutex(cache_locking(d.locking)){
+		query_cache.max_size      =d.query_cache_size;
+		query_cache.max_sql_length=d.query_cache_max_sql_length;
+
+		//sqlite silently ignores a page size that is not a power of two
+		if(d.page_size.is_set and (d.page_size.value & (d.page_size.value-1))!=0){
+			throw DbError_connect("sqlite : page_size must be a power of two. File=" + d.filepath + ", page_size=" + std::to_string(d.page_size.value));
+		}
+
+		//a memory image is loaded in an empty in memory database, that must be writable
+		int flags = d.open_flags();
+		if(d.memory_image){flags = (flags & ~SQLITE_OPEN_READONLY) | SQLITE_OPEN_READWRITE | SQLITE_OPEN_MEMORY;}
+
+		int rc = sqlite3_open_v2(d.memory_image ? ":memory:" : d.filepath.c_str(), &db, flags, nullptr);
+		if(rc!= SQLITE_OK){
+			const std::string msg = db==nullptr ? "out of memory" : sqlite3_errmsg(db);
+			sqlite3_close_v2(db); //a handle is allocated even on error
+			db=nullptr;
+			throw DbError_connect("sqlite : cannot init. File=" + d.filepath + ", error=" + std::to_string(rc) + ", msg=" + msg);
+		}
+
+		if(d.memory_image){
+			try{load_image(d);}
+			catch(...){sqlite3_close_v2(db); db=nullptr; throw;}
+		}
 
 		//we expect that a database handle columns
 		this->execute("PRAGMA foreign_keys = ON");
@@ -75,9 +124,135 @@ namespace sqlwrapper{
 		set_limit(d.max_trigger_depth);
 		set_limit(d.max_attached);
 		//set_limit(d.max_page_count);
+
+		apply_pragmas(d);
+	}
+
+
+	//--- pragmas ---
+	inline void DbManager<Sqlite_tag>::apply_pragmas(const DbConnectInfo_t &d){
+		auto set_pragma=[&](const char *name, const std::string &value){
+			execute(std::string("PRAGMA ") + name + "=" + value);
+		};
+		auto set_int=[&](const DbConnectInfo_t::Pragma_t<int> &p){
+			if(p.is_set){set_pragma(p.name,std::to_string(p.value));}
+		};
+
+		//page size first : it is fixed once the database is in WAL mode
+		set_int(d.page_size);
+		if(d.journal_mode.is_set){
+			const char *modes[]={"DELETE","TRUNCATE","PERSIST","MEMORY","WAL","OFF"};
+			set_pragma(d.journal_mode.name,modes[static_cast<int>(d.journal_mode.value)]);
+		}
+		if(d.synchronous.is_set){set_pragma(d.synchronous.name,std::to_string(static_cast<int>(d.synchronous.value)));}
+		set_int(d.cache_size);
+		if(d.mmap_size.is_set){set_pragma(d.mmap_size.name,std::to_string(d.mmap_size.value));}
+		if(d.temp_store.is_set){set_pragma(d.temp_store.name,std::to_string(static_cast<int>(d.temp_store.value)));}
+		set_int(d.threads);
+		set_int(d.wal_autocheckpoint);
+		set_int(d.busy_timeout);
+	}
+
+	//--- memory image ---
+	inline void DbManager<Sqlite_tag>::load_image(const DbConnectInfo_t &d){
+		//read the file through sqlite, so pages still in a WAL file are included
+		sqlite3 *file = nullptr;
+		int rc = sqlite3_open_v2(d.filepath.c_str(), &file, SQLITE_OPEN_READONLY | (d.uri ? SQLITE_OPEN_URI : 0), nullptr);
+		if(rc==SQLITE_CANTOPEN and d.create and !d.read_only){sqlite3_close_v2(file); return;} //new database
+		if(rc!=SQLITE_OK){
+			const std::string msg = file==nullptr ? "out of memory" : sqlite3_errmsg(file);
+			sqlite3_close_v2(file);
+			throw DbError_connect("sqlite : cannot load memory image. File=" + d.filepath + ", error=" + std::to_string(rc) + ", msg=" + msg);
+		}
+
+		sqlite3_int64 size = 0;
+		unsigned char *image = sqlite3_serialize(file, "main", &size, 0);
+		const std::string msg = sqlite3_errmsg(file);
+		sqlite3_close_v2(file);
+		if(size==0){sqlite3_free(image); return;} //empty file
+		if(image==nullptr){
+			throw DbError_connect("sqlite : cannot serialize database. File=" + d.filepath + ", msg=" + msg);
+		}
+
+		//in memory databases cannot use WAL : mark the image as a rollback journal database
+		if(size>=20 and image[18]==2){image[18]=1; image[19]=1;}
+
+		//sqlite frees image, even on error
+		const unsigned int image_flags = SQLITE_DESERIALIZE_FREEONCLOSE | (d.read_only ? SQLITE_DESERIALIZE_READONLY : SQLITE_DESERIALIZE_RESIZEABLE);
+		rc = sqlite3_deserialize(db, "main", image, size, size, image_flags);
+		if(rc!=SQLITE_OK){
+			throw DbError_connect("sqlite : cannot deserialize database. File=" + d.filepath + ", error=" + std::to_string(rc) + ", msg=" + sqlite3_errmsg(db));
+		}
+	}
+
+	inline void DbManager<Sqlite_tag>::persist(const std::string &path_){
+		if(path_.empty() and !connect_info.memory_image){
+			throw DbError_file("sqlite : cannot persist database, no path given and the connection is not a memory_image. File=" + connect_info.filepath);
+		}
+		const std::string path = path_.empty() ? connect_info.filepath : path_;
+		const std::string tmp  = path + "-tmp";
+		Write_lock db_lock(db_mutex);
+		commit_pending();
+
+		std::remove(tmp.c_str());
+		sqlite3 *target = nullptr;
+		int rc = sqlite3_open_v2(tmp.c_str(), &target, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+		if(rc==SQLITE_OK){
+			sqlite3_backup *backup = sqlite3_backup_init(target, "main", db, "main");
+			if(backup!=nullptr){
+				sqlite3_backup_step(backup, -1);
+				sqlite3_backup_finish(backup); //the error of the copy, if any, is kept by target
+			}
+			rc = sqlite3_errcode(target);
+		}
+		const std::string msg = target==nullptr ? "out of memory" : sqlite3_errmsg(target);
+		sqlite3_close_v2(target);
+
+		if(rc!=SQLITE_OK){
+			std::remove(tmp.c_str());
+			throw DbError_file("sqlite : cannot persist database. File=" + path + ", error=" + std::to_string(rc) + ", msg=" + msg);
+		}
+		if(std::rename(tmp.c_str(), path.c_str())!=0){
+			std::remove(tmp.c_str());
+			throw DbError_file("sqlite : cannot persist database, rename failed. File=" + path);
+		}
+	}
+
+	inline auto DbManager<Sqlite_tag>::pragmas()->Pragma_values{
+		typedef DbConnectInfo_t::Journal_mode Journal_mode;
+		Pragma_values r;
+		int i;
+		Read_lock db_lock(db_mutex);
+
+		getRow("PRAGMA page_size",r.page_size);
+
+		std::string mode;
+		getRow("PRAGMA journal_mode",mode);
+		for(auto &c : mode){c=std::tolower(static_cast<unsigned char>(c));}
+		if     (mode=="delete"  ){r.journal_mode=Journal_mode::Delete;}
+		else if(mode=="truncate"){r.journal_mode=Journal_mode::Truncate;}
+		else if(mode=="persist" ){r.journal_mode=Journal_mode::Persist;}
+		else if(mode=="memory"  ){r.journal_mode=Journal_mode::Memory;}
+		else if(mode=="wal"     ){r.journal_mode=Journal_mode::Wal;}
+		else if(mode=="off"     ){r.journal_mode=Journal_mode::Off;}
+		else{throw DbError_get("sqlite : unknown journal_mode=" + mode);}
+
+		getRow("PRAGMA synchronous",i);
+		r.synchronous=static_cast<DbConnectInfo_t::Synchronous>(i);
+		getRow("PRAGMA cache_size",r.cache_size);
+
+		getRow_optional("PRAGMA mmap_size",r.mmap_size); //no row when memory mapping is not compiled in
+
+		getRow("PRAGMA temp_store",i);
+		r.temp_store=static_cast<DbConnectInfo_t::Temp_store>(i);
+		getRow("PRAGMA threads",r.threads);
+		getRow("PRAGMA wal_autocheckpoint",r.wal_autocheckpoint);
+		getRow("PRAGMA busy_timeout",r.busy_timeout);
+		return r;
 	}
 
 	inline auto DbManager<Sqlite_tag>::prepare(const Sql_t &sql)->Query_t{
+		Read_lock db_lock(db_mutex);
 		Query_t Query_t;
 		auto status = sqlite3_prepare_v2(db, sql.c_str(), -1, &Query_t.statment, 0);
 		if(status !=  SQLITE_OK){throw DbError_query("sqlite : bad Query_t : error=" + std::to_string(status)+ " Query_t=" + sql +", msg="+sqlite3_errmsg(db) );}
@@ -85,18 +260,304 @@ namespace sqlwrapper{
 	}
 
 	inline void DbManager<Sqlite_tag>::prepare(Query_t & target, const Sql_t &sql){
+		Read_lock db_lock(db_mutex);
 		target.clear();
 		auto status = sqlite3_prepare_v2(db, sql.c_str(), -1, &target.statment, 0);
 		if(status !=  SQLITE_OK){throw DbError_query("sqlite : bad Query_t : error=" + std::to_string(status)+ " Query_t=" + sql +", msg="+sqlite3_errmsg(db));}
 	}
 
-	inline auto DbManager<Sqlite_tag>::transaction()->DbTransaction_t{return DbTransaction_t(*this);}
+	//--- prepared statement cache ---
+	inline DbManager<Sqlite_tag>::Cached_query::Cached_query(DbManager_t &db_, const Sql_t &sql):db(db_){
+		Query_cache &c = db.query_cache;
+		const bool cacheable = c.max_size!=0 and sql.size()<=c.max_sql_length;
+
+		if(cacheable){
+			std::unique_lock<mt_impl::Lock_t> cache_lock(db.cache_mutex);
+			auto found = c.index.find(sql);
+			if(found!=c.index.end() and !found->second->in_use){
+				entry=found->second;
+				entry->in_use=true;
+				c.lru.splice(c.lru.begin(),c.lru,entry);
+				++c.stats.hit;
+				cached=true;
+				query=entry->query.get();
+				return;
+			}
+			++c.stats.miss;
+		}
+
+		own.reset(new Query_t(db.prepare(sql)));
+		query=own.get();
+		if(!cacheable){return;}
+
+		//store the new statement, unless another user already cached the same sql
+		std::unique_lock<mt_impl::Lock_t> cache_lock(db.cache_mutex);
+		if(c.index.find(sql)!=c.index.end()){return;}
+		c.lru.emplace_front(sql,std::move(own));
+		entry=c.lru.begin();
+		entry->in_use=true;
+		c.index.emplace(sql,entry);
+		cached=true;
+		query=entry->query.get();
+		db.query_cache_evict();
+	}
+
+	inline DbManager<Sqlite_tag>::Cached_query::~Cached_query(){
+		if(!cached){return;}
+		std::unique_lock<mt_impl::Lock_t> cache_lock(db.cache_mutex);
+		entry->in_use=false;
+		db.query_cache_evict();
+	}
+
+	inline void DbManager<Sqlite_tag>::query_cache_evict(){
+		Query_cache &c = query_cache;
+		auto it = c.lru.end();
+		while(c.lru.size()>c.max_size and it!=c.lru.begin()){
+			--it;
+			if(it->in_use){continue;}
+			c.index.erase(it->sql);
+			it=c.lru.erase(it);
+			++c.stats.evicted;
+		}
+		c.stats.size=c.lru.size();
+	}
+
+	inline auto DbManager<Sqlite_tag>::query_cache_stats()->Query_cache_stats{
+		std::unique_lock<mt_impl::Lock_t> cache_lock(cache_mutex);
+		return query_cache.stats;
+	}
+
+	inline void DbManager<Sqlite_tag>::query_cache_clear(){
+		std::unique_lock<mt_impl::Lock_t> cache_lock(cache_mutex);
+		const size_t max_size = query_cache.max_size;
+		query_cache.max_size=0;
+		query_cache_evict();
+		query_cache.max_size=max_size;
+	}
+
+
+	inline auto DbManager<Sqlite_tag>::transaction(Begin_mode mode)->DbTransaction_t{return DbTransaction_t(*this,mode);}
 	inline auto DbManager<Sqlite_tag>::savepoint()  ->DbSavepoint_t  {return DbSavepoint_t  (*this);}
 
 
+	//--- transactions and savepoints ---
+	inline auto DbManager<Sqlite_tag>::control_query(std::unique_ptr<Query_t> &q, const char *sql)->Query_t&{
+		if(!q){q.reset(new Query_t(prepare(sql)));}
+		return *q;
+	}
+
+	inline int DbManager<Sqlite_tag>::control_step(Query_t &q){
+		int rc;
+		do{rc = step(q.statment);}while(rc==SQLITE_ROW);
+		sqlite3_reset(q.statment); //keeps the error message in the connection
+		return rc==SQLITE_DONE ? SQLITE_OK : rc;
+	}
+
+	inline void DbManager<Sqlite_tag>::control(Query_t &q){
+		const int rc = control_step(q);
+		if(rc!=SQLITE_OK){
+			throw DbError_execute("sqlite : error during execute : querry_result=" + std::to_string(rc)+", sql="+q.sql()+", msg="+sqlite3_errmsg(db));
+		}
+	}
+
+	inline void DbManager<Sqlite_tag>::begin(Begin_mode mode){
+		const char *sql[]={"BEGIN DEFERRED TRANSACTION","BEGIN IMMEDIATE TRANSACTION","BEGIN EXCLUSIVE TRANSACTION"};
+		const int i = static_cast<int>(mode);
+		control(control_query(control_queries.begin[i],sql[i]));
+	}
+
+	inline void DbManager<Sqlite_tag>::commit  (){control(control_query(control_queries.commit  ,"COMMIT"  ));}
+	inline void DbManager<Sqlite_tag>::rollback(){control(control_query(control_queries.rollback,"ROLLBACK"));}
+
+	inline auto DbManager<Sqlite_tag>::savepoint_open()->Savepoint_id_t{
+		Savepoint_id_t id;
+		if(control_queries.free_savepoints.empty()){
+			id = control_queries.savepoints.size();
+			const Sql_t name = "s" + std::to_string(id);
+			Control_queries::Savepoint q;
+			q.open    .reset(new Query_t(prepare("SAVEPOINT "   + name)));
+			q.release .reset(new Query_t(prepare("RELEASE "     + name)));
+			q.rollback.reset(new Query_t(prepare("ROLLBACK TO " + name)));
+			control_queries.savepoints.push_back(std::move(q));
+		}else{
+			id = control_queries.free_savepoints.back();
+			control_queries.free_savepoints.pop_back();
+		}
+		try{control(*control_queries.savepoints[id].open);}
+		catch(...){savepoint_free(id); throw;}
+		return id;
+	}
+
+	inline void DbManager<Sqlite_tag>::savepoint_release(Savepoint_id_t id){control(*control_queries.savepoints[id].release);}
+
+	//ROLLBACK TO keeps the savepoint open : release it too, so its name can be reused
+	inline void DbManager<Sqlite_tag>::savepoint_rollback(Savepoint_id_t id){
+		control(*control_queries.savepoints[id].rollback);
+		control(*control_queries.savepoints[id].release);
+	}
+
+
+	//--- commit policy ---
+	inline void DbManager<Sqlite_tag>::set_commit_policy(const Commit_policy &p){
+		Write_lock db_lock(db_mutex);
+		commit_pending();
+		commit_policy=p;
+		commit_timer_start(); //never joins the timer : the caller may already be in a section of db_mutex
+	}
+
+	inline void DbManager<Sqlite_tag>::commit_pending(){
+		Write_lock db_lock(db_mutex);
+		if(!commit_batch.open){return;}
+		int querry_result =control_step(control_query(control_queries.commit,"COMMIT"));
+		if (querry_result != SQLITE_OK  ){
+			//a busy COMMIT keeps the transaction open, it is committed later. Other errors may roll it back
+			if(sqlite3_get_autocommit(db)){commit_batch.open=false;}
+			throw DbError_execute("sqlite : error during implicit commit : querry_result=" + std::to_string(querry_result)+", msg="+sqlite3_errmsg(db));
+		}
+		commit_batch.open=false;
+		++commit_stats_.commits;
+		commit_stats_.rows+=commit_batch.rows;
+		commit_stats_.time+=std::chrono::steady_clock::now()-commit_batch.begin;
+	}
+
+	inline void DbManager<Sqlite_tag>::autocommit_begin(Query_t &query){
+		if(commit_batch.open or !commit_policy.enabled()){return;}
+		if(sqlite3_stmt_readonly(query.statment)){return;} //also true for BEGIN, COMMIT...
+		if(sqlite3_get_autocommit(db)==0){return;}         //the user manages transactions
+		int querry_result =control_step(control_query(control_queries.begin[0],"BEGIN DEFERRED TRANSACTION"));
+		if (querry_result != SQLITE_OK  ){
+			throw DbError_execute("sqlite : error during implicit begin : querry_result=" + std::to_string(querry_result)+", msg="+sqlite3_errmsg(db));
+		}
+		commit_batch.open =true;
+		commit_batch.rows =0;
+		commit_batch.begin=std::chrono::steady_clock::now();
+	}
+
+	inline void DbManager<Sqlite_tag>::autocommit_add(){
+		if(!commit_batch.open){return;}
+		commit_batch.rows+=sqlite3_changes(db);
+		if(commit_policy.rows!=0 and commit_batch.rows>=commit_policy.rows){commit_pending(); return;}
+		if(commit_policy.period.count()!=0 and std::chrono::steady_clock::now()-commit_batch.begin >= commit_policy.period){commit_pending();}
+	}
+
+	inline void DbManager<Sqlite_tag>::autocommit_abort(){
+		if(!commit_batch.open){return;}
+		if(sqlite3_get_autocommit(db)){commit_batch.open=false; return;} //sqlite already rolled back
+		try{commit_pending();}catch(DbError &){}
+	}
+
+	inline void DbManager<Sqlite_tag>::commit_timer_start(){
+		if(db==nullptr or db_mutex.policy()==mt_impl::Lock_t::Policy::None){return;}
+		if(commit_timer.joinable()){ //running : it reads the new period
+			{
+				std::unique_lock<std::mutex> l(commit_timer_mutex);
+				commit_timer_reload=true;
+			}
+			commit_timer_cond.notify_all();
+			return;
+		}
+		if(commit_policy.period.count()==0){return;}
+		commit_timer_stopping=false;
+		commit_timer_reload  =true;
+		commit_timer=std::thread([this]{commit_timer_run();});
+	}
+
+	inline void DbManager<Sqlite_tag>::commit_timer_stop(){
+		if(!commit_timer.joinable()){return;}
+		{
+			std::unique_lock<std::mutex> l(commit_timer_mutex);
+			commit_timer_stopping=true;
+		}
+		commit_timer_cond.notify_all();
+		commit_timer.join();
+	}
+
+	//sleep until the implicit transaction is period old, then commit it.
+	//commit_timer_reload : the policy changed, read its period now. Without period, sleep until it changes
+	inline void DbManager<Sqlite_tag>::commit_timer_run(){
+		typedef std::chrono::steady_clock Clock;
+		Clock::duration wait(0);
+		std::unique_lock<std::mutex> l(commit_timer_mutex);
+		auto woken=[this]{return commit_timer_stopping or commit_timer_reload;};
+		while(true){
+			if(wait.count()==0){commit_timer_cond.wait(l,woken);}
+			else               {commit_timer_cond.wait_for(l,wait,woken);}
+			if(commit_timer_stopping){return;}
+			commit_timer_reload=false;
+			l.unlock();
+			{
+				Write_lock db_lock(db_mutex);
+				wait = commit_policy.period;
+				if(wait.count()!=0 and commit_batch.open){
+					const auto age = Clock::now()-commit_batch.begin;
+					if(age<wait){wait-=age;}
+					else{
+						try{commit_pending();}
+						catch(DbError &){} //kept open if it failed, retried next period
+					}
+				}
+			}
+			l.lock();
+		}
+	}
+
+
+	//--- busy retry ---
+	inline int DbManager<Sqlite_tag>::step_busy(sqlite3_stmt *s, int rc){
+		typedef std::chrono::steady_clock Clock;
+		const DbConnectInfo_t::Busy_retry &r = connect_info.busy_retry;
+		const auto begin = Clock::now();
+		const auto end   = begin + r.max_wait;
+
+		static thread_local std::minstd_rand random(static_cast<unsigned int>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+		std::uniform_real_distribution<double> shorten(0,std::min(std::max(r.jitter,0.0),1.0));
+
+		size_t retries=0;
+		std::chrono::microseconds delay = r.first_delay;
+		while(r.enabled() and ((rc&0xff)==SQLITE_BUSY or (rc&0xff)==SQLITE_LOCKED)){
+			const auto now = Clock::now();
+			if(now>=end){break;}
+			auto sleep = std::chrono::duration_cast<Clock::duration>(delay*(1-shorten(random)));
+			std::this_thread::sleep_for(std::min<Clock::duration>(sleep,end-now));
+			++retries;
+			rc = sqlite3_step(s);
+			delay = std::min(delay*2,r.max_delay);
+		}
+
+		std::unique_lock<std::mutex> l(busy_stats_mutex);
+		++busy_stats_.busy;
+		busy_stats_.retries+=retries;
+		busy_stats_.wait   +=Clock::now()-begin;
+		if((rc&0xff)==SQLITE_BUSY or (rc&0xff)==SQLITE_LOCKED){++busy_stats_.failures;}
+		return rc;
+	}
+
+	inline auto DbManager<Sqlite_tag>::busy_stats()->Busy_stats{
+		std::unique_lock<std::mutex> l(busy_stats_mutex);
+		return busy_stats_;
+	}
+
+	inline int DbManager<Sqlite_tag>::exec(const char *sql){
+		while(*sql!=0){
+			sqlite3_stmt *s   =nullptr;
+			const char   *tail=nullptr;
+			int rc = sqlite3_prepare_v2(db, sql, -1, &s, &tail);
+			if(rc!=SQLITE_OK){return rc;}
+			if(s==nullptr){return SQLITE_OK;} //only spaces or comments left
+			do{rc = step(s);}while(rc==SQLITE_ROW);
+			sqlite3_finalize(s); //keeps the error message in the connection
+			if(rc!=SQLITE_DONE){return rc;}
+			sql=tail;
+		}
+		return SQLITE_OK;
+	}
+
+
 	//special version : NO DATA AND string : treat string as multiple queries
 	inline void DbManager<Sqlite_tag>::execute(const std::string &s){
-		int querry_result =sqlite3_exec(db, s.c_str(), NULL, 0, NULL);
+		Write_lock db_lock(db_mutex);
+		commit_pending();
+		int querry_result =exec(s.c_str());
 		if (querry_result != SQLITE_OK  ){
 			throw DbError_execute(
 					"sqlite : error during execute (string) "
@@ -110,22 +571,26 @@ namespace sqlwrapper{
 	//https://www.sqlite.org/c3ref/bind_blob.html
 	template<typename... Data>
 	void DbManager<Sqlite_tag>::execute(Query_t &query, Data... bind_me){
+		Write_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
 
 		//bind all arguments
 		query.bind(bind_me...);
+		autocommit_begin(query);
 
 		//run the Query_t
 		int querry_result;
 		do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 
 		 }while(querry_result  == SQLITE_ROW);
 
 		if(querry_result!=SQLITE_DONE){
-			throw DbError_execute("sqlite : error during execute : querry_result=" + std::to_string(querry_result)+", sql="+query.sql()+", msg="+sqlite3_errmsg(db)
-			);
+			const std::string msg = "sqlite : error during execute : querry_result=" + std::to_string(querry_result)+", sql="+query.sql()+", msg="+sqlite3_errmsg(db);
+			autocommit_abort();
+			throw DbError_execute(msg);
 		}
+		autocommit_add();
 
 		//reset (by Query_t guard)
 
@@ -162,6 +627,7 @@ namespace sqlwrapper{
 	template<template<typename, typename...> class Cont, typename ... Args>
 	Cont<Column_info_t>   DbManager<Sqlite_tag>::getColumn_info(Query_t &query, Args ... bind_me ){
 		Cont<Column_info_t> R;
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
 
 		//bind all arguments
@@ -189,6 +655,7 @@ namespace sqlwrapper{
 	//https://www.sqlite.org/c3ref/bind_blob.html
 	template<typename... Data>
 	auto DbManager<Sqlite_tag>::insertRow(Query_t &query, Data... data)->Rowid_t{
+		Write_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
 
 		//bind all arguments
@@ -197,15 +664,19 @@ namespace sqlwrapper{
 
 		//run the Query_t
 		int querry_result;
-		std::unique_lock<std::mutex> db_lock(db_mutex);
-		do{querry_result = sqlite3_step(query.statment);}
+		autocommit_begin(query);
+		do{querry_result = step(query.statment);}
 		while(querry_result  == SQLITE_ROW);
 
 		//check results
-		if(querry_result!=SQLITE_DONE){throw DbError_execute("sqlite : error during execute, querry_result=" + std::to_string(querry_result)+", sql="+query.sql()+", msg="+sqlite3_errmsg(db));}
+		if(querry_result!=SQLITE_DONE){
+			const std::string msg = "sqlite : error during execute, querry_result=" + std::to_string(querry_result)+", sql="+query.sql()+", msg="+sqlite3_errmsg(db);
+			autocommit_abort();
+			throw DbError_execute(msg);
+		}
 
 		auto rowid=sqlite3_last_insert_rowid(db);
-		db_lock.unlock();
+		autocommit_add();
 
 
 		return rowid; //and reset Query_t (by query_guard)
@@ -216,6 +687,7 @@ namespace sqlwrapper{
 
 	template< typename ...Args >
 	void DbManager<Sqlite_tag>::insertTuple(Query_t &query, const std::tuple<Args...>  &tuple){
+		Write_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
 		Tuple_bind_r fn(query);
 		tuple_apply(tuple,fn);
@@ -225,14 +697,172 @@ namespace sqlwrapper{
 	//idem but insert stuff from a container of tuple
 	template< template <typename...> class Cont, typename ...Args >
 	void DbManager<Sqlite_tag>::insertTable(Query_t &query, const Cont<std::tuple<Args...> >  &data_container){
+		Write_lock db_lock(db_mutex);
 		for(const auto & data : data_container ){insertTuple(query,data);}
 	}
 
 
+	//--- batch insert ---
+	inline bool DbManager<Sqlite_tag>::batch_split(const Sql_t &sql, Batch_sql &target){
+		//find the VALUES keyword : a whole word, outside quoted strings, quoted identifiers and comments.
+		//none, or more than one : not a simple INSERT ... VALUES(...), it is inserted row by row
+		auto is_word=[](char c){return std::isalnum(static_cast<unsigned char>(c)) or c=='_' or c=='$' or (c&0x80)!=0;};
+		size_t values_pos = Sql_t::npos;
+		for(size_t i = 0; i < sql.size(); ++i){
+			const char c = sql[i];
+			if(c=='\'' or c=='"' or c=='`' or c=='['){
+				const char end = c=='[' ? ']' : c;
+				i = sql.find(end,i+1); //a doubled quote is two quoted parts
+				if(i==Sql_t::npos){return false;}
+				continue;
+			}
+			if(c=='-' and i+1<sql.size() and sql[i+1]=='-'){
+				i = sql.find('\n',i);
+				if(i==Sql_t::npos){break;}
+				continue;
+			}
+			if(c=='/' and i+1<sql.size() and sql[i+1]=='*'){
+				i = sql.find("*/",i+2);
+				if(i==Sql_t::npos){return false;}
+				++i;
+				continue;
+			}
+			if(!is_word(c)){continue;}
+
+			size_t end = i;
+			while(end<sql.size() and is_word(sql[end])){++end;}
+			bool match = end-i==6;
+			for(size_t j = 0; j<6 and match; ++j){match = (std::tolower(static_cast<unsigned char>(sql[i+j]))=="values"[j]);}
+			if(match){
+				if(values_pos!=Sql_t::npos){return false;} //ambiguous
+				values_pos=i;
+			}
+			i=end-1;
+		}
+		if(values_pos==Sql_t::npos){return false;}
+
+		//(...) must follow, with balanced parenthesis and only ? as parameters
+		size_t open = values_pos+6;
+		while(open<sql.size() and std::isspace(static_cast<unsigned char>(sql[open]))){++open;}
+		if(open>=sql.size() or sql[open]!='('){return false;}
+
+		int    depth  = 0;
+		char   quote  = 0;
+		size_t params = 0;
+		size_t close  = open;
+		for(; close<sql.size(); ++close){
+			const char c = sql[close];
+			if(quote!=0){if(c==quote){quote=0;} continue;}
+			if(c=='\'' or c=='"'){quote=c; continue;}
+			if(c==':' or c=='@' or c=='$'){return false;}
+			if(c=='?'){
+				if(close+1<sql.size() and std::isdigit(static_cast<unsigned char>(sql[close+1]))){return false;}
+				++params;
+			}
+			if(c=='('){++depth;}
+			if(c==')'){--depth; if(depth==0){break;}}
+		}
+		if(close>=sql.size() or params==0){return false;}
+
+		//nothing but ; and spaces after the row
+		for(size_t i = close+1; i<sql.size(); ++i){
+			if(sql[i]!=';' and !std::isspace(static_cast<unsigned char>(sql[i]))){return false;}
+		}
+
+		target.head       = sql.substr(0,open);
+		target.row        = sql.substr(open,close+1-open);
+		target.tail       = sql.substr(close+1);
+		target.row_params = params;
+		return true;
+	}
+
+	inline auto DbManager<Sqlite_tag>::batch_sql(const Batch_sql &b, size_t rows)->Sql_t{
+		Sql_t r;
+		r.reserve(b.head.size() + rows*(b.row.size()+1) + b.tail.size());
+		r+=b.head;
+		for(size_t i = 0; i<rows; ++i){
+			if(i!=0){r+=',';}
+			r+=b.row;
+		}
+		r+=b.tail;
+		return r;
+	}
+
+	inline size_t DbManager<Sqlite_tag>::batch_rows(const Batch_sql &b){
+		const size_t max_variable = sqlite3_limit(db,SQLITE_LIMIT_VARIABLE_NUMBER,-1);
+		const size_t max_sql      = sqlite3_limit(db,SQLITE_LIMIT_SQL_LENGTH,-1);
+		size_t rows = std::min(connect_info.insert_batch_rows, max_variable/b.row_params);
+		const size_t fixed = b.head.size()+b.tail.size();
+		if(max_sql>fixed){rows = std::min(rows, (max_sql-fixed)/(b.row.size()+1) );}
+		//big statements would be prepared for each call, and waste the cache
+		const size_t max_cached = query_cache.max_sql_length;
+		if(max_cached>fixed){rows = std::min(rows, (max_cached-fixed)/(b.row.size()+1) );}
+		return std::max<size_t>(rows,1);
+	}
+
+	template<typename It, typename Bind_fn>
+	bool DbManager<Sqlite_tag>::insert_batch(const Sql_t &sql, It begin, It end, Bind_fn bind_row){
+		Batch_sql b;
+		if(!batch_split(sql,b)){return false;}
+		Write_lock db_lock(db_mutex);
+
+		const size_t chunk = batch_rows(b);
+		size_t remaining   = std::distance(begin,end);
+
+		auto run_chunk=[&](Query_t &q, size_t rows){
+			Query_guard query_guard(q);
+			for(size_t i = 0; i<rows; ++i, ++begin){bind_row(q,*begin);}
+			this->execute(q);
+		};
+
+		if(chunk>1 and remaining>=chunk){
+			Cached_query q(*this, batch_sql(b,chunk));
+			while(remaining>=chunk){
+				run_chunk(q.get(),chunk);
+				remaining-=chunk;
+			}
+		}
+
+		//one statement per remainder width would fill the cache : use the single row sql
+		if(remaining!=0){
+			Cached_query q(*this, sql);
+			for(; remaining!=0; --remaining){run_chunk(q.get(),1);}
+		}
+		return true;
+	}
+
+	template< template <typename...> class Cont, typename ...Args >
+	void DbManager<Sqlite_tag>::insertTable_batch(const Sql_t &sql, const Cont<std::tuple<Args...> >  &data_container){
+		auto bind_row=[](Query_t &q, const std::tuple<Args...> &t){
+			Tuple_bind_r fn(q);
+			tuple_apply(t,fn);
+		};
+		if(insert_batch(sql,data_container.begin(),data_container.end(),bind_row)){return;}
+		this->insertTable(sql,data_container);
+	}
+
+	template<typename Container>
+	void DbManager<Sqlite_tag>::insertColumn_batch(const Sql_t &sql, const Container &c){
+		auto bind_row=[](Query_t &q, const typename Container::value_type &v){q.bind(v);};
+		if(insert_batch(sql,c.begin(),c.end(),bind_row)){return;}
+		this->insertColumn(sql,c);
+	}
+
+	template< template <typename...> class Cont, typename ...Args >
+	void DbManager<Sqlite_tag>::insertTable_batch(Query_t &query, const Cont<std::tuple<Args...> >  &data_container){
+		this->insertTable_batch(query.sql(),data_container);
+	}
+
+	template<typename Container>
+	void DbManager<Sqlite_tag>::insertColumn_batch(Query_t &query, const Container &c){
+		this->insertColumn_batch(query.sql(),c);
+	}
+
+
 	template<typename...Args > //get a single line. throw if 0 or >=1 data was returned
 	void DbManager<Sqlite_tag>::getRow (Query_t &query, Args &... arg){
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 		//bind nothing
 
 		 //check : correct number of cols
@@ -247,7 +877,7 @@ namespace sqlwrapper{
 		int querry_result;
 		char line_count=0;
 		while(true){
-			querry_result = sqlite3_step(query.statment);
+			querry_result = step(query.statment);
 			if(querry_result != SQLITE_ROW){break;}
 			query.setFrom(arg...);
 			++line_count;
@@ -265,8 +895,8 @@ namespace sqlwrapper{
 
 	template<typename...Args > //get a single line. throw if 0 or >=1 data was returned
 	bool DbManager<Sqlite_tag>::getRow_optional (Query_t &query, Args &... arg){
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 		//bind nothing
 
 		 //check : correct number of cols
@@ -281,7 +911,7 @@ namespace sqlwrapper{
 		int querry_result;
 		char line_count=0;
 		while(true){
-			querry_result = sqlite3_step(query.statment);
+			querry_result = step(query.statment);
 			if(querry_result != SQLITE_ROW){break;}
 			query.setFrom(arg...);
 			++line_count;
@@ -301,8 +931,8 @@ namespace sqlwrapper{
 
 	template< typename ...Args >
 	void DbManager<Sqlite_tag>::getTuple (Query_t &query   , std::tuple<Args...> &t){
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 		//bind nothing
 
 		 //check : correct number of cols
@@ -318,7 +948,7 @@ namespace sqlwrapper{
 		char line_count=0;
 		Tuple_setFrom_r fn(query); //<----change here
 		do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 			 if(querry_result  == SQLITE_ROW){
 				 tuple_apply(t,fn);     //<----change here
 				 ++line_count;
@@ -337,8 +967,8 @@ namespace sqlwrapper{
 
 	template< template <typename...> class Cont, typename ...Args >
 	void DbManager<Sqlite_tag>::getTable (Query_t &query,Cont<std::tuple<Args...> > &target){
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 
 		 //check : correct number of cols
 		 if(sqlite3_column_count(query.statment) != sizeof...(Args)){
@@ -353,7 +983,7 @@ namespace sqlwrapper{
 		std::tuple<Args...> tmp_tuple;
 		Tuple_setFrom_r fn(query);
 		do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 			 if(querry_result  == SQLITE_ROW){
 				 tuple_apply(tmp_tuple,fn);
 				 unicont::move_in(target,std::move(tmp_tuple));
@@ -371,6 +1001,7 @@ namespace sqlwrapper{
 	template<typename Cont, typename ... Args>
 	void DbManager<Sqlite_tag>::getColumn(Query_t &query, Cont &c, Args ... bind_me ){
 		//bind
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
 		query.bind(bind_me...);
 
@@ -387,7 +1018,7 @@ namespace sqlwrapper{
 		 int querry_result;
 
 		 do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 			 if(querry_result  == SQLITE_ROW){
 				 value_t v;
 				 query.setFrom(v);
@@ -407,8 +1038,8 @@ namespace sqlwrapper{
 	template<typename Fn>
 	bool  DbManager<Sqlite_tag>::getApply_bool(Query_t &query  , Fn applied_fn){
 		using namespace tuple_tools;
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 
 		typedef typename tuple_arguments<Fn>::type Tuple_t;
 		const size_t tuple_size = std::tuple_size<Tuple_t>::value;
@@ -427,7 +1058,7 @@ namespace sqlwrapper{
 		Tuple_setFrom_r fn(query);
 		bool ok;
 		do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 			 if(querry_result  == SQLITE_ROW){
 				 tuple_apply(tmp_tuple,fn); //get tuple
 				 ok = tuple_function(applied_fn,tmp_tuple);//call fn from tuple
@@ -445,8 +1076,8 @@ namespace sqlwrapper{
 	template<typename Fn>
 	void DbManager<Sqlite_tag>::getApply_void(Query_t &query  , Fn applied_fn){
 		using namespace tuple_tools;
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 
 		typedef typename tuple_arguments<Fn>::type Tuple_t;
 		const size_t tuple_size = std::tuple_size<Tuple_t>::value;
@@ -464,7 +1095,7 @@ namespace sqlwrapper{
 		Tuple_t tmp_tuple;
 		Tuple_setFrom_r fn(query);
 		do{
-			 querry_result = sqlite3_step(query.statment);
+			 querry_result = step(query.statment);
 			 if(querry_result  == SQLITE_ROW){
 				 tuple_apply(tmp_tuple,fn); //get tuple
 				 tuple_function(applied_fn,tmp_tuple);//call fn from tuple
@@ -503,8 +1134,8 @@ namespace sqlwrapper{
 	template<typename Fn>
 	auto DbManager<Sqlite_tag>::getApply(const Sql_t &sql, Fn fn)
 		->typename  tuple_tools::return_type<Fn>::type{
-		Query_t q=this->prepare(sql);
-		return getApply(q,fn);
+		Cached_query q(*this,sql);
+		return getApply(q.get(),fn);
 	}
 
 
@@ -522,67 +1153,54 @@ namespace sqlwrapper{
 
 
 
-	template<typename... Args>
-	DbManager<Sqlite_tag>::GetData_apply<std::tuple<Args...> >::GetData_apply(Query_t &q):fn(q),query(q){
-		//check todo optimize : do it for 1st Query_t only
-		if(sqlite3_column_count(query.statment) != sizeof...(Args)){
-			 throw DbError_get("sqlite : wrong column number in apply (table number of columns doesn't match function number of args),"
-						", function_arg=" + std::to_string(sizeof...(Args))
-					   +", table_col="    + std::to_string( sqlite3_column_count(query.statment) )
-					   +", sql=" +query.sql());
-		}
+	//apply fn in parallel
+	//This code has high synchronization costs. Running fn in parallel
+	//is faster only if fn is slower than getting data out of the db
+	//for best performance, write a benchmark with parallel v.s. not parallel
+	template<typename Fn>
+	auto DbManager<Sqlite_tag>::getApply_parallel(const Sql_t &sql, Fn fn,const size_t cache_size)-> typename tuple_tools::return_type<Fn>::type{
+		Cached_query q(*this,sql);
+		return getApply_parallel(q.get(),fn,cache_size);
 	}
 
-
-	template<typename... Args>
-	std::tuple<Args...> DbManager<Sqlite_tag>::GetData_apply<std::tuple<Args...> >::get_data(){
-		std::tuple <Args...> tmp_tuple;
-		tuple_apply(tmp_tuple,fn);
-		return tmp_tuple;
+	template<typename Fn>
+	auto DbManager<Sqlite_tag>::getApply_parallel(Query_t &query, Fn fn,const size_t cache_size)-> typename tuple_tools::return_type<Fn>::type{
+		Parallel_options options;
+		options.page_size=cache_size;
+		return getApply_parallel(query,fn,options);
 	}
 
-	template<typename... Args>
-	bool DbManager<Sqlite_tag>::GetData_apply<std::tuple<Args...> >::have_data()const{
-		//try to launch the request
-		querry_result = sqlite3_step(query.statment);
-		if(querry_result == SQLITE_ROW) {return true;}
-		if(querry_result == SQLITE_DONE){return false;}
-		throw DbError_execute("sqlite : error in apply during execute : querry_result=" + std::to_string(querry_result) + ", sql=" + query.sql()+", msg="+sqlite3_errmsg(db));
+	template<typename Fn>
+	auto DbManager<Sqlite_tag>::getApply_parallel(const Sql_t &sql, Fn fn,const Parallel_options &options)-> typename tuple_tools::return_type<Fn>::type{
+		Cached_query q(*this,sql);
+		return getApply_parallel(q.get(),fn,options);
 	}
 
-
-
-
-	//apply fn in parallel
-	//This code has high synchronization costs. Running fn in parallel
-	//is faster only if fn is slower than getting data out of the db
-	//for best performance, write a benchmark with parallel v.s. not parallel
-	template<typename Fn>
-	auto DbManager<Sqlite_tag>::getApply_parallel(const Sql_t &sql, Fn fn,const size_t cache_size)-> void{
-		auto q = this->prepare(sql);
-		getApply_parallel(q,fn,cache_size);
+	inline auto DbManager<Sqlite_tag>::parallel_stats()->Parallel_stats{
+		std::unique_lock<std::mutex> l(parallel_stats_mutex);
+		return parallel_stats_;
 	}
 
 
 
 
-	template<typename Fn>
-	auto DbManager<Sqlite_tag>::getApply_parallel(Query_t &query  , Fn applied_fn, const size_t cache_size)-> void{
+	template<typename Tuple_t, typename Process_t, typename Hook_t>
+	auto DbManager<Sqlite_tag>::parallel_run(Query_t &query, Process_t process_fn, const Parallel_options &options_, Hook_t before_fetch)->Parallel_stats{
 		using namespace sqlwrapper::mt_impl;
-		using namespace tuple_tools;
-
-		typedef typename tuple_arguments<Fn>::type Tuple_t;
 		typedef typename JobPool_run<Tuple_t>::Page Page_t;
 
 		//few thread -> single thread version
+		Parallel_options options = options_;
 		unsigned int hardware_thread = std::thread::hardware_concurrency();
-		if(hardware_thread<2){this->getApply(query,applied_fn); return;}
+		if(hardware_thread<2){options.sequential=true;}
 
 		const size_t tuple_size = std::tuple_size<Tuple_t>::value;
+		const size_t page_size  = std::max<size_t>(options.page_size,1);
+		size_t row_heap = 0; //biggest heap of a row so far, used to keep room for the next row
 
 
+		Read_lock db_lock(db_mutex);
 		Query_guard query_guard(query);
-		std::unique_lock<std::mutex> db_lock(db_mutex);
 
 		//check : correct number of cols
 		 if(sqlite3_column_count(query.statment) !=tuple_size){
@@ -593,20 +1211,52 @@ namespace sqlwrapper{
 		 }
 
 		auto fetch_fn=[&](Page_t &write_here)->bool{
+			before_fetch();
 			size_t row_count =0;
-			write_here.reserve(cache_size);
+			const size_t limit = write_here.limit==0 ? page_size : write_here.limit; //tuned in adaptive mode
+			const size_t page_bytes = write_here.max_bytes;
+
+			//byte budget : the page is measured like JobPool_t does (byte_size, capacity and recycled rows included),
+			//and cut when the next row may not fit. The rows vector only grows by what fits.
+			size_t byte_count = 0;
+			if(page_bytes==0){write_here.reserve(limit);}
+			else             {byte_count=byte_size(write_here);}
+			auto has_room=[&]()->bool{
+				if(page_bytes==0){return true;}
+				auto &rows = write_here.rows;
+				if(write_here.size()<rows.size()){ //a recycled row : its buffers are already counted
+					const size_t heap = byte_size_heap(rows[write_here.size()]);
+					return byte_count+(row_heap>heap ? row_heap-heap : 0)<=page_bytes;
+				}
+				const size_t need = byte_count+row_heap;
+				if(need>page_bytes){return false;}
+				if(rows.size()<rows.capacity()){return true;}
+				const size_t fits = (page_bytes-need)/sizeof(Tuple_t);
+				if(fits==0){return false;}
+				const size_t grow = std::min(fits, std::min(std::max<size_t>(rows.capacity(),8), limit-row_count));
+				rows.reserve(rows.capacity()+grow);
+				byte_count+=grow*sizeof(Tuple_t);
+				return true;
+			};
 
 			int querry_result;
 
 			Tuple_setFrom_r fn(query);
 			do{
-				 querry_result = sqlite3_step(query.statment);
+				 querry_result = step(query.statment);
 				 if(querry_result  == SQLITE_ROW){
-					 write_here.emplace_back();
-					 tuple_apply(write_here.back(),fn);
+					 auto &row = write_here.next_row(); //recycled rows keep their string buffers
+					 if(page_bytes==0){tuple_apply(row,fn);}
+					 else{
+						 const size_t before = byte_size_heap(row);
+						 tuple_apply(row,fn);
+						 const size_t after  = byte_size_heap(row);
+						 byte_count = byte_count+after-before;
+						 row_heap   = std::max(row_heap,after);
+					 }
 				 }
 				 ++row_count;
-			}while(querry_result  == SQLITE_ROW and row_count <cache_size );
+			}while(querry_result  == SQLITE_ROW and row_count <limit and has_room());
 
 			if(querry_result!=SQLITE_DONE and querry_result!=SQLITE_ROW){
 				throw DbError_execute("sqlite : error during execute : querry_result=" + std::to_string(querry_result) + ", sql=" + query.sql()+", msg="+sqlite3_errmsg(db));
@@ -615,14 +1265,273 @@ namespace sqlwrapper{
 			return querry_result==SQLITE_ROW;
 		};
 
-		auto process_fn=[&applied_fn](Page_t &process_me)->void{
+		//a stopped scan leaves the statement in the middle of its rows : Query_guard resets it
+		auto stats = JobPool_run<Tuple_t>::run(fetch_fn,process_fn,options);
+		std::unique_lock<std::mutex> l(parallel_stats_mutex);
+		parallel_stats_=stats;
+		return stats;
+	}
+
+
+	template<typename Fn>
+	auto DbManager<Sqlite_tag>::getApply_parallel(Query_t &query  , Fn applied_fn, const Parallel_options &options)-> typename tuple_tools::return_type<Fn>::type{
+		using namespace tuple_tools;
+		typedef typename tuple_arguments<Fn>::type   Tuple_t;
+		typedef typename return_type<Fn>::type       Return_t;
+		typedef typename std::is_same<Return_t,bool>::type Returns_bool;
+		typedef typename mt_impl::JobPool_run<Tuple_t>::Page Page_t;
+
+		//once a row returns false, the other workers skip their remaining rows
+		std::atomic<bool> stop(false);
+		auto process_fn=[&](Page_t &process_me)->bool{
+			for(auto &t : process_me){
+				if(stop.load(std::memory_order_relaxed)){return false;}
+				if(options.cancel!=nullptr and options.cancel->load(std::memory_order_relaxed)){return false;}
+				if(!parallel_apply(applied_fn,t,Returns_bool())){stop=true; return false;}
+			};
+			return true;
+		};
+
+		const auto stats = parallel_run<Tuple_t>(query,process_fn,options);
+		return static_cast<Return_t>(!stats.stopped); //void if Fn returns void
+	}
+
+
+	template<typename Fn, typename Sink>
+	void DbManager<Sqlite_tag>::getApply_parallel_ordered(const Sql_t &sql, Fn fn, Sink sink, const Parallel_options &options){
+		Cached_query q(*this,sql);
+		getApply_parallel_ordered(q.get(),fn,sink,options);
+	}
+
+	template<typename Fn, typename Sink>
+	void DbManager<Sqlite_tag>::getApply_parallel_ordered(Query_t &query, Fn applied_fn, Sink sink, const Parallel_options &options){
+		using namespace tuple_tools;
+		typedef typename tuple_arguments<Fn>::type Tuple_t;
+		typedef typename return_type<Fn>::type     Result_t;
+		typedef typename mt_impl::JobPool_run<Tuple_t>::Page Page_t;
+		typedef std::vector<Result_t> Result_page_t;
+		static_assert(!std::is_void<Result_t>::value,"getApply_parallel_ordered : fn must return a value");
+
+		//results are reordered by page, then given row by row to sink
+		auto page_sink=[&sink](Result_page_t &&page){
+			for(auto &r : page){sink(std::move(r));}
+		};
+
+		//more room than pages in flight : a finished page rarely waits for a slow one
+		const size_t capacity = 2*(options.max_pages==0 ? mt_impl::guess_thread_number()*10 : options.max_pages);
+		mt_impl::ReorderBuffer_t<Result_page_t,decltype(page_sink)> reorder(page_sink,capacity);
+
+		auto process_fn=[&](Page_t &process_me)->void{
+			Result_page_t results;
+			results.reserve(process_me.size());
+			for(auto &t : process_me){
+				results.emplace_back(tuple_function(applied_fn,t));
+			};
+			reorder.push(process_me.seq,std::move(results));
+		};
+
+		//results are reordered by whole pages.
+		//once the scan stops (cancel, or an exception), dropped pages are never pushed : later pages must not wait for them
+		Parallel_options whole_pages = options;
+		whole_pages.steal_chunk=0;
+		whole_pages.on_stop=[&reorder,&options](){
+			reorder.abort();
+			if(options.on_stop){options.on_stop();}
+		};
+		parallel_run<Tuple_t>(query,process_fn,whole_pages);
+	}
+
+
+
+	template<typename Acc, typename Map_fn, typename Merge_fn>
+	Acc DbManager<Sqlite_tag>::getReduce_parallel(const Sql_t &sql, const Acc &init, Map_fn map_fn, Merge_fn merge_fn, const Parallel_options &options){
+		Cached_query q(*this,sql);
+		return getReduce_parallel(q.get(),init,map_fn,merge_fn,options);
+	}
+
+	template<typename Acc, typename Map_fn, typename Merge_fn>
+	Acc DbManager<Sqlite_tag>::getReduce_parallel(Query_t &query, const Acc &init, Map_fn map_fn, Merge_fn merge_fn, const Parallel_options &options){
+		using namespace tuple_tools;
+		typedef typename tuple_tail<typename tuple_arguments<Map_fn>::type>::type Tuple_t; //drop Acc&
+		typedef typename mt_impl::JobPool_run<Tuple_t>::Page Page_t;
+
+		//one accumulator per worker, on its own cache lines
+		struct alignas(64) Slot{
+			explicit Slot(const Acc &a):acc(a){}
+			Acc acc;
+		};
+		std::vector<Slot> slots;
+		const size_t threads = options.max_thread_number(); //one accumulator per worker index
+		slots.reserve(threads);
+		for(size_t i = 0; i < threads; ++i){slots.emplace_back(init);}
+
+		auto process_fn=[&](Page_t &process_me)->void{
+			Reduce_bind<Map_fn,Acc> bind{map_fn,slots[mt_impl::job_worker_index()].acc};
 			for(auto &t : process_me){
-				tuple_function(applied_fn,t);
+				tuple_function(bind,t);
 			};
 		};
 
-		JobPool_run<Tuple_t>::run(fetch_fn,process_fn);
+		parallel_run<Tuple_t>(query,process_fn,options);
+
+		Acc result = std::move(slots[0].acc);
+		for(size_t i = 1; i < slots.size(); ++i){merge_fn(result,std::move(slots[i].acc));}
+		return result;
+	}
+
+
+
+	template<typename... Args>
+	void DbManager<Sqlite_tag>::bind_result(Query_t &q, const std::tuple<Args...> &t){
+		Tuple_bind_r fn(q);
+		tuple_apply(t,fn);
+	}
+
+	template<typename T>
+	void DbManager<Sqlite_tag>::bind_result(Query_t &q, const T &t){q.bind(t);}
+
+	template<typename Fn>
+	size_t DbManager<Sqlite_tag>::getPipeline_parallel(const Sql_t &sql, Fn fn, const Sql_t &write_sql, const Pipeline_options &options){
+		Cached_query q(*this,sql);
+		return getPipeline_parallel(q.get(),fn,write_sql,options);
+	}
+
+	template<typename Fn>
+	size_t DbManager<Sqlite_tag>::getPipeline_parallel(Query_t &query, Fn fn, const Sql_t &write_sql, const Pipeline_options &options){
+		using namespace tuple_tools;
+		typedef typename tuple_arguments<Fn>::type Tuple_t;
+		typedef typename return_type<Fn>::type     Result_t;
+		typedef typename mt_impl::JobPool_run<Tuple_t>::Page Page_t;
+		typedef std::vector<Result_t> Result_page_t;
+		static_assert(!std::is_void<Result_t>::value,"getPipeline_parallel : fn must return the values to write");
+		Write_lock db_lock(db_mutex); //the fetch section of parallel_run runs in it
+
+		//transform : results of processed pages wait for the writer
+		std::mutex                 ready_mutex;
+		std::vector<Result_page_t> ready;
+
+		auto process_fn=[&](Page_t &process_me)->void{
+			Result_page_t results;
+			results.reserve(process_me.size());
+			for(auto &t : process_me){
+				results.emplace_back(tuple_function(fn,t));
+			};
+			std::unique_lock<std::mutex> l(ready_mutex);
+			ready.emplace_back(std::move(results));
+		};
+
+		//write : on the calling thread, between two fetches. pending results are bounded by the pages in flight
+		Cached_query write_query(*this,write_sql);
+		std::vector<Result_page_t> writing;
+		size_t written=0;
+
+		auto bind_row=[](Query_t &q, const Result_t &r){bind_result(q,r);};
+		auto write_ready=[&](){
+			{
+				std::unique_lock<std::mutex> l(ready_mutex);
+				writing.swap(ready);
+			}
+			for(auto &page : writing){
+				if(!insert_batch(write_sql,page.begin(),page.end(),bind_row)){
+					Query_t &q = write_query.get();
+					for(const auto &r : page){
+						Query_guard query_guard(q);
+						bind_row(q,r);
+						this->execute(q);
+					}
+				}
+				written+=page.size();
+			}
+			writing.clear();
+		};
+
+		//the implicit transactions of the commit policy group the writes
+		const Commit_policy saved_policy = commit_policy;
+		commit_pending();
+		commit_policy = options.commit;
+		try{
+			parallel_run<Tuple_t>(query,process_fn,options,write_ready);
+			write_ready();
+			commit_pending();
+		}catch(...){
+			commit_policy = saved_policy;
+			autocommit_abort();
+			throw;
+		}
+		commit_policy = saved_policy;
+		return written;
+	}
+
+
+
+	template<typename Fn>
+	bool DbManager<Sqlite_tag>::getApply_partitioned(const Sql_t &sql, Fn fn, const Partition_options &options){
+		typedef std::is_same<typename tuple_tools::return_type<Fn>::type,bool> Return_bool_t;
+
+		if(connect_info.in_memory()){
+			throw DbError_connect("sqlite : partitioned scan needs a database file, file=" + connect_info.filepath);
+		}
+		commit_pending();
+
+		//key range
+		::sqlwrapper::Optional<sqlite3_int64> first_key, last_key;
+		getRow("SELECT min(" + options.key + "), max(" + options.key + ") FROM " + options.table, first_key, last_key);
+		if(!first_key.first){return true;} //empty table
+
+		//split [first,last] in contiguous ranges
+		const size_t partitions = options.partitions==0 ? mt_impl::guess_thread_number() : options.partitions;
+		const sqlite3_uint64 span = static_cast<sqlite3_uint64>(last_key.second) - static_cast<sqlite3_uint64>(first_key.second);
+		const sqlite3_uint64 step = span/partitions + 1;
+
+		std::vector<std::pair<sqlite3_int64,sqlite3_int64> > ranges;
+		for(sqlite3_uint64 offset = 0; offset<=span; offset+=step){
+			const sqlite3_uint64 width = std::min(step-1,span-offset);
+			const sqlite3_int64  begin = static_cast<sqlite3_int64>(static_cast<sqlite3_uint64>(first_key.second)+offset);
+			ranges.emplace_back(begin, static_cast<sqlite3_int64>(static_cast<sqlite3_uint64>(begin)+width));
+			if(span-offset<step){break;} //avoid overflow of offset
+		}
+
+		//one read only connection per range
+		DbConnectInfo_t reader_info(connect_info);
+		reader_info.read_only=true;
+
+		std::atomic<bool>  all_ok(true);
+		auto run_range=[&](const std::pair<sqlite3_int64,sqlite3_int64> &r){
+			DbManager_t reader(reader_info);
+			Query_t q = reader.prepare(sql);
+			q.bind(r.first,r.second);
+			Fn local_fn(fn);
+			if(!partition_apply(reader,q,local_fn,Return_bool_t())){all_ok=false;}
+		};
+
+		//nested call from a worker : run here
+		if(mt_impl::ThreadPool_t::in_worker()){
+			for(const auto &r : ranges){run_range(r);}
+			return all_ok;
+		}
+
+		std::mutex              done_mutex;
+		std::condition_variable done_cond;
+		size_t                  running=ranges.size();
+		std::exception_ptr      error;
+
+		mt_impl::ThreadPool_t &pool = mt_impl::ThreadPool_t::global();
+		for(const auto &r : ranges){
+			pool.submit([&,r](){
+				std::exception_ptr e;
+				try{run_range(r);}
+				catch(...){e=std::current_exception();}
+				std::unique_lock<std::mutex> l(done_mutex);
+				if(e and !error){error=e;}
+				--running;
+				done_cond.notify_all(); //lock held : the caller may return as soon as running==0
+			});
+		}
 
+		std::unique_lock<std::mutex> l(done_mutex);
+		done_cond.wait(l,[&]{return running==0;});
+		if(error){std::rethrow_exception(error);}
+		return all_ok;
 	}
 
 
@@ -0,0 +1,90 @@
+#ifndef INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBPOOL_TPP_
+#define INCLUDE_SQLWRAPPER_SQLITE_IMPL_DBPOOL_TPP_
+
+namespace sqlwrapper{
+
+
+
+		inline DbPool<Sqlite_tag>::DbPool(const DbConnectInfo_t &c, size_t reader_number){
+			if(c.in_memory()){
+				throw DbError_connect("sqlite : a connection pool needs a database file, file=" + c.filepath);
+			}
+			if(reader_number==0){reader_number=std::max<unsigned int>(std::thread::hardware_concurrency(),1);}
+
+			//the writer creates the file, and switches it to WAL (that is persistent)
+			DbConnectInfo_t writer_info(c);
+			writer_info.read_only=false;
+			writer_db.reset(new DbManager_t(writer_info));
+
+			std::string mode;
+			writer_db->getRow("PRAGMA journal_mode=WAL",mode);
+			if(mode!="wal"){
+				throw DbError_connect("sqlite : cannot switch the pool database to WAL, journal_mode=" + mode + ", file=" + c.filepath);
+			}
+
+			DbConnectInfo_t reader_info(c);
+			reader_info.read_only=true;
+			readers.reserve(reader_number);
+			free_readers.reserve(reader_number);
+			for(size_t i = 0; i < reader_number; ++i){
+				readers.emplace_back(new DbManager_t(reader_info));
+				free_readers.push_back(readers.back().get());
+			}
+		}
+
+		inline DbPool<Sqlite_tag>::~DbPool(){
+			assert(writer_free and free_readers.size()==readers.size()); //a lease outlives the pool
+		}
+
+
+		inline auto DbPool<Sqlite_tag>::reader()->Lease{
+			std::unique_lock<std::mutex> l(mutex);
+			++stats_.reader_leases;
+			if(free_readers.empty()){
+				++stats_.reader_waits;
+				cond.wait(l,[this]{return !free_readers.empty();});
+			}
+			DbManager_t *db = free_readers.back();
+			free_readers.pop_back();
+			return Lease(*this,*db,false);
+		}
+
+		inline auto DbPool<Sqlite_tag>::writer()->Lease{
+			std::unique_lock<std::mutex> l(mutex);
+			++stats_.writer_leases;
+			if(!writer_free){
+				++stats_.writer_waits;
+				cond.wait(l,[this]{return writer_free;});
+			}
+			writer_free=false;
+			return Lease(*this,*writer_db,true);
+		}
+
+		inline auto DbPool<Sqlite_tag>::stats()->Stats{
+			std::unique_lock<std::mutex> l(mutex);
+			return stats_;
+		}
+
+		inline void DbPool<Sqlite_tag>::give_back(DbManager_t *db, bool writer){
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				if(writer){writer_free=true;}
+				else      {free_readers.push_back(db);}
+			}
+			cond.notify_all(); //readers and the writer wait on the same condition
+		}
+
+
+
+		inline DbPool<Sqlite_tag>::Lease::Lease(Lease &&l):pool(l.pool),db(l.db),writer(l.writer){
+			l.db=nullptr;
+		}
+
+		inline DbPool<Sqlite_tag>::Lease::~Lease(){
+			if(db!=nullptr){pool->give_back(db,writer);}
+		}
+
+
+}
+
+#endif
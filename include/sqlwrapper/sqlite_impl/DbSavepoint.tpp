@@ -7,16 +7,17 @@
 namespace sqlwrapper{
 
 
-	inline DbSavepoint<Sqlite_tag>::DbSavepoint(DbManager<Sqlite_tag> &db_):db(db_){
-		savepoint_id=db.savepoint_newid();
-		db.execute("SAVEPOINT " + savepoint_id);
+	inline DbSavepoint<Sqlite_tag>::DbSavepoint(DbManager<Sqlite_tag> &db_):db(db_),db_lock(db_.db_mutex){
+		db.commit_pending();
+		savepoint_id=db.savepoint_open();
 	}
 
 
 	inline DbSavepoint<Sqlite_tag>::DbSavepoint(DbSavepoint<Sqlite_tag> &&s):
 				done(s.done),
-				savepoint_id(std::move(s.savepoint_id)),
-				db(s.db)
+				savepoint_id(s.savepoint_id),
+				db(s.db),
+				db_lock(std::move(s.db_lock))
 	{s.done=true;}
 
 
@@ -25,15 +26,19 @@ namespace sqlwrapper{
 
 	inline void  DbSavepoint<Sqlite_tag>::rollback(){
 		if(done){return;}
-		db.execute("ROLLBACK TO SAVEPOINT " + savepoint_id);
+		db.savepoint_rollback(savepoint_id);
 		done=true;
+		db.savepoint_free(savepoint_id);
+		db_lock.unlock();
 	}
 
 
 	inline void  DbSavepoint<Sqlite_tag>::release() {
 		if(done){return;}
-		db.execute("RELEASE SAVEPOINT "     + savepoint_id);
+		db.savepoint_release(savepoint_id);
 		done=true;
+		db.savepoint_free(savepoint_id);
+		db_lock.unlock();
 	}
 
 
@@ -5,14 +5,15 @@ namespace sqlwrapper{
 
 
 
-		inline DbTransaction<Sqlite_tag>::DbTransaction(DbManager<Sqlite_tag> &db_)
-		:db(db_) {
-			db.execute("BEGIN TRANSACTION");
+		inline DbTransaction<Sqlite_tag>::DbTransaction(DbManager<Sqlite_tag> &db_, DbManager<Sqlite_tag>::Begin_mode mode)
+		:db(db_),db_lock(db_.db_mutex) {
+			db.commit_pending();
+			db.begin(mode);
 		}
 
 
 		inline DbTransaction<Sqlite_tag>::DbTransaction(DbTransaction<Sqlite_tag> &&s)
-		:done(s.done),db(s.db){
+		:done(s.done),db(s.db),db_lock(std::move(s.db_lock)){
 			s.done=true;
 		}
 
@@ -20,15 +21,17 @@ namespace sqlwrapper{
 
 		inline void DbTransaction<Sqlite_tag>::rollback(){
 			if(done){return;}
-			db.execute("ROLLBACK");
+			db.rollback();
 			done=true;
+			db_lock.unlock();
 		}
 
 
 		inline void DbTransaction<Sqlite_tag>::commit  (){
 			if(done){return;}
-			db.execute("COMMIT");
+			db.commit();
 			done=true;
+			db_lock.unlock();
 		}
 
 
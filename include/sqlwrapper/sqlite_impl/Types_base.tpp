@@ -54,7 +54,9 @@ namespace sqlwrapper{
 			//doc : https://stackoverflow.com/questions/804123/const-unsigned-char-to-stdstring
 			const auto coltype=sqlite3_column_type(query.statment,I);
 			if(coltype!=SQLITE_TEXT){throw DbError_wrongtype("sqlite : wrong type cannot get string ,column="+std::to_string(I)+", sql="+query.sql()+ ", type=" + sqlite_impl::sqlite_coltype(coltype));}
-			t=static_cast<std::string>( reinterpret_cast<const char*>(sqlite3_column_text  (query.statment,I)) );
+			//assign keeps the capacity of t, so recycled strings are not reallocated
+			const char *text = reinterpret_cast<const char*>(sqlite3_column_text(query.statment,I));
+			t.assign(text, sqlite3_column_bytes(query.statment,I));
 
 		}
 	};
@@ -8,6 +8,7 @@
 // Description : tuple_arguments<Fn>::type extract Fn arguments into a tuple
 //               return_type<Fn>::type     is the type returned by Fn
 //               tuple_function(fn, t)     calls the function fn by passing tuple t content as function arguments.
+//               tuple_tail<Tuple>::type   is Tuple without its first type
 //============================================================================
 
 /*
@@ -107,6 +108,17 @@ auto tuple_function(Fn fn, Tuple &t)
 }
 
 
+//remove the first type of a tuple
+//tuple_tail<std::tuple<A,B,C>>::type is std::tuple<B,C>
+template<class Tuple>
+struct tuple_tail;
+
+template<class A, class... B>
+struct tuple_tail<std::tuple<A,B...> >
+{ typedef std::tuple<B...> type; };
+
+
+
 //easily get the return type of a callable
 template<typename Fn>
 struct return_type{
@@ -166,6 +166,16 @@ void test_classical(){
 		v.emplace_back(3,"three"); v.emplace_back(4,"four");
 		db.insertTable("insert into test values(?,?)",v );
 
+		//idem, but rows are sent as multi-row VALUES (?,?),(?,?)... chunks, sized to fit con.max_variable_number
+		std::vector<std::tuple<int,std::string> > v_batch;
+		v_batch.emplace_back(5,"five"); v_batch.emplace_back(6,"six");
+		db.insertTable_batch("insert into test values(?,?)",v_batch );
+
+
+		//raw sql strings are prepared once, then reused from a per connection LRU cache
+		//its size is set by con.query_cache_size, statistics are in db.query_cache_stats()
+		auto cache_stats = db.query_cache_stats();
+		assert(cache_stats.hit>0); //"insert into test values(?,?)" was reused
 
 		//manage queries by hand (queries can be used instead of raw sql strings in all requests)
 		auto query = db.prepare("insert into test values(?,?)");//query is a sqlwrapper::Query<sqlwrapper::Sqlite_tag>
@@ -340,6 +350,91 @@ void test_classical(){
 
 
 
+
+//insertTable_batch sends insert_batch_rows rows per statement : fewer statements to step than insertTable
+void test_batch_insert(){
+	sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>   con("test.sqlite3");
+	con.insert_batch_rows=64;
+	auto db = sqlwrapper::make_DbManager(con);
+	db.execute("drop table if exists test_batch");
+	db.execute("create table test_batch(i integer NOT NULL, s varchar, d real, primary key(i))");
+
+	std::vector<std::tuple<int,std::string,double> > v;
+	for(int i = 0; i < 20000+10; ++i){v.emplace_back(i,"row "+std::to_string(i),i*0.5);}
+
+	//best of 3, inside a transaction : only statement costs are compared
+	auto best_time=[&](bool batch){
+		std::chrono::steady_clock::duration best = std::chrono::hours(1);
+		for(int run = 0; run < 3; ++run){
+			db.execute("delete from test_batch");
+			auto transaction = db.transaction();
+			auto start = std::chrono::steady_clock::now();
+			if(batch){db.insertTable_batch("insert into test_batch values(?,?,?)",v);}
+			else     {db.insertTable      ("insert into test_batch values(?,?,?)",v);}
+			best = std::min(best,std::chrono::steady_clock::now()-start);
+			transaction.commit();
+		}
+		return best;
+	};
+
+	const auto row_time   = best_time(false);
+	const auto cache_size = db.query_cache_stats().size;
+	const auto batch_time = best_time(true);
+	assert(db.query_cache_stats().size==cache_size+1); //only the 64 rows statement was added
+
+	std::vector<std::tuple<int,std::string,double> > r;
+	db.getTable("select * from test_batch order by i",r);
+	assert(r==v); //the 10 last rows do not fill a chunk, they are inserted one by one
+	//timings depend on the machine : printed, not checked
+	std::cout << "insertTable : "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(row_time  ).count() << "us, insertTable_batch : "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(batch_time).count() << "us\n";
+
+	//values only as a whole keyword : identifiers, strings and comments containing it are not split
+	db.execute("drop table if exists values_tbl");
+	db.execute("create table values_tbl(i integer NOT NULL, myvalues varchar, primary key(i))");
+	std::vector<std::tuple<int,std::string> > w;
+	for(int i = 0; i < 100; ++i){w.emplace_back(i,"values("+std::to_string(i)+")");}
+	for(const std::string sql : {
+		"insert into values_tbl(i,myvalues) values(?,?)",
+		"insert into [values_tbl](i,\"myvalues\") VALUES (?, ? || '') ;",
+		"insert into values_tbl(i,myvalues) values(?,?) -- not values(?,?)",
+		"insert into values_tbl(i,myvalues) select * from (values(?,?))"
+	}){
+		db.execute("delete from values_tbl");
+		db.insertTable_batch(sql,w);
+		std::vector<std::tuple<int,std::string> > r;
+		db.getTable("select i, myvalues from values_tbl order by i",r);
+		assert(r==w);
+	}
+}
+
+
+
+//getApply_parallel with a byte budget : pages are cut so that fetched and not yet processed rows stay below max_bytes
+void test_parallel_budget(){
+	sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>   con("test.sqlite3");
+	auto db = sqlwrapper::make_DbManager(con);
+	db.execute("drop table if exists test_budget");
+	db.execute("create table test_budget(i integer NOT NULL, s varchar, primary key(i))");
+	std::vector<std::tuple<int,std::string> > v;
+	for(int i = 0; i < 5000; ++i){v.emplace_back(i,std::string(100,'x'));}
+	db.insertTable_batch("insert into test_budget values(?,?)",v);
+
+	std::atomic<long> sum(0);
+	decltype(db)::Parallel_options options;
+	options.max_bytes=20000;
+	options.threads  =3;
+	db.getApply_parallel("select i,s from test_budget",[&sum](int i, std::string s){sum+=i+s.size();},options);
+
+	auto stats = db.parallel_stats();
+	assert(sum==4999L*5000/2+5000*100);
+	assert(stats.rows==5000);
+	assert(stats.peak_bytes<=options.max_bytes);
+	assert(stats.pages>5000/options.page_size); //pages were cut by bytes, not by page_size rows
+}
+
+
 void test_date(){
 	//create a connection
 		sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>   con("test.sqlite3");
@@ -460,13 +555,716 @@ void test_column_description(){
 }
 
 
+
+//drop and create table(i integer NOT NULL, columns..., primary key(i)), then insert i=0..rows-1
+template<typename DbManager_t>
+std::vector<int> make_test_table(DbManager_t &db, const std::string &table, const int rows, const std::string &columns=""){
+	db.execute("drop table if exists "+table);
+	db.execute("create table "+table+"(i integer NOT NULL, "+columns+(columns.empty() ? "" : ", ")+"primary key(i))");
+	std::vector<int> v;
+	for(int i = 0; i < rows; ++i){v.push_back(i);}
+	db.insertColumn_batch("insert into "+table+"(i) values(?)",v);
+	return v;
+}
+
+
+
+//commit policy : bulk writes outside a transaction are grouped in implicit transactions
+void test_commit_policy(){
+	typedef sqlwrapper::DbManager<sqlwrapper::Sqlite_tag> DbManager_t;
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	make_test_table(db,"test_commit",0);
+
+	//commit every 100 rows
+	DbManager_t::Commit_policy policy;
+	policy.rows=100;
+	db.set_commit_policy(policy);
+	for(int i = 0; i < 250; ++i){db.insertRow("insert into test_commit values(?)",i);}
+	assert(db.commit_stats().commits==2);
+	db.commit_pending(); //the last 50 rows
+	assert(db.commit_stats().commits==3);
+	assert(db.commit_stats().rows==250);
+
+	//commit after 20ms, even if no write follows
+	policy.rows  =0;
+	policy.period=std::chrono::milliseconds(20);
+	db.set_commit_policy(policy);
+	db.insertRow("insert into test_commit values(?)",1000);
+	const auto deadline = std::chrono::steady_clock::now()+std::chrono::seconds(10);
+	while(db.commit_stats().commits==3 and std::chrono::steady_clock::now()<deadline){usleep(1000);}
+	assert(db.commit_stats().commits==4); //by the timer
+	size_t n;
+	auto other = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	other.getRow("select count(*) from test_commit",n);
+	assert(n==251);
+
+	//in a transaction, while the timer waits for the connection
+	{
+		auto transaction = db.transaction();
+		usleep(50000); //more than the period
+		policy.period=std::chrono::milliseconds(10);
+		db.set_commit_policy(policy);
+		assert(db.get_commit_policy().period==policy.period);
+		transaction.commit();
+	}
+	db.set_commit_policy(DbManager_t::Commit_policy()); //back to autocommit
+}
+
+
+
+//parallel functions run their pages on a persistent thread pool, also usable directly
+void test_thread_pool(){
+	typedef sqlwrapper::mt_impl::ThreadPool_t ThreadPool_t;
+	ThreadPool_t pool(2,4);
+	assert(pool.size()==2);
+	pool.reserve(100); //capped
+	assert(pool.size()==4);
+	assert(pool.max_threads()==4);
+
+	std::mutex              m;
+	std::condition_variable cond;
+	size_t done=0;
+	bool   in_worker=true;
+	for(int i = 0; i < 100; ++i){
+		pool.submit([&](){
+			const bool w = ThreadPool_t::in_worker();
+			std::unique_lock<std::mutex> l(m);
+			in_worker = in_worker and w;
+			++done;
+			cond.notify_all();
+		});
+	}
+	std::unique_lock<std::mutex> l(m);
+	cond.wait(l,[&]{return done==100;});
+	assert(in_worker);
+	assert(!ThreadPool_t::in_worker());
+}
+
+
+
+//ordered parallel apply : fn runs in parallel, sink gets its results in the query order
+void test_parallel_ordered(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_ordered",5000);
+
+	decltype(db)::Parallel_options options;
+	options.page_size=16;
+	std::vector<int> result;
+	db.getApply_parallel_ordered("select i from test_ordered order by i",
+			[](int i){if(i%7==0){usleep(10);} return 2*i;},
+			[&result](int &&r){result.push_back(r);},
+			options);
+	assert(result.size()==v.size());
+	for(size_t i = 0; i < result.size(); ++i){assert(result[i]==2*v[i]);}
+
+	//fn throws on the first page, while other workers are already waiting for it
+	options.page_size=1;
+	options.max_pages=8;
+	bool thrown=false;
+	try{
+		db.getApply_parallel_ordered("select i from test_ordered order by i",
+				[](int i){if(i==0){usleep(10000); throw std::runtime_error("fn");} return i;},
+				[](int &&){},
+				options);
+	}catch(std::runtime_error &){thrown=true;}
+	assert(thrown);
+
+	//cancel mid scan : pages not processed yet are dropped, sink got the first results
+	std::atomic<bool> cancel(false);
+	options.cancel=&cancel;
+	result.clear();
+	db.getApply_parallel_ordered("select i from test_ordered order by i",
+			[&cancel](int i){if(i==100){cancel=true;} return i;},
+			[&result](int &&r){result.push_back(r);},
+			options);
+	assert(result.size()<v.size());
+	for(size_t i = 0; i < result.size(); ++i){assert(result[i]==v[i]);}
+}
+
+
+
+//partitioned scan : rowid ranges are scanned on their own read only connections
+void test_partitioned(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_partition",10000);
+
+	decltype(db)::Partition_options options;
+	options.table="test_partition";
+	options.partitions=4;
+	std::vector<int> seen(v.size(),0);
+	const bool all = db.getApply_partitioned("select i from test_partition where rowid between ? and ?",
+			[&seen](int i){++seen[i];},options);
+	assert(all);
+	for(int n : seen){assert(n==1);} //every row once
+}
+
+
+
+//pages and their rows are recycled : in steady state a scan allocates nothing
+void test_page_recycling(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	db.execute("drop table if exists test_recycle");
+	db.execute("create table test_recycle(i integer NOT NULL, s varchar, primary key(i))");
+	std::vector<std::tuple<int,std::string> > v;
+	for(int i = 0; i < 20000; ++i){v.emplace_back(i,"row "+std::to_string(i));}
+	db.insertTable_batch("insert into test_recycle values(?,?)",v);
+
+	decltype(db)::Parallel_options options;
+	options.page_size=64;
+	options.max_pages=4;
+	std::atomic<long> sum(0);
+	db.getApply_parallel("select i,s from test_recycle",[&sum](int i, std::string){sum+=i;},options);
+	auto stats = db.parallel_stats();
+	assert(sum==19999L*20000/2);
+	assert(stats.pages==20000/64+1);
+	const size_t max_alive = options.max_pages+options.thread_number(); //in flight, and held by workers
+	assert(stats.pages_allocated<=max_alive); //a page is recycled once processed
+	assert(stats.rows_allocated <=max_alive*options.page_size);
+}
+
+
+
+//the ring between the fetcher and the workers : bounded, lock free, FIFO
+void test_ring_buffer(){
+	sqlwrapper::mt_impl::RingBuffer_t<int> ring(5);
+	assert(ring.capacity()==8); //rounded up to a power of two
+	for(int i = 0; i < 8; ++i){assert(ring.try_push(i));}
+	int x=100;
+	assert(!ring.try_push(x)); //full
+	assert(x==100);
+	for(int i = 0; i < 8; ++i){assert(ring.try_pop(x)); assert(x==i);}
+	assert(!ring.try_pop(x));  //empty
+
+	//one producer, several consumers
+	sqlwrapper::mt_impl::RingBuffer_t<int> mpmc(16);
+	std::atomic<long> sum(0);
+	std::atomic<bool> done(false);
+	std::vector<std::thread> consumers;
+	for(int t = 0; t < 3; ++t){
+		consumers.emplace_back([&](){
+			int y;
+			while(true){
+				const bool d = done;
+				if(mpmc.try_pop(y)){sum+=y; continue;}
+				if(d){return;}
+				std::this_thread::yield();
+			}
+		});
+	}
+	for(int i = 1; i <= 10000; ++i){
+		int y=i;
+		while(!mpmc.try_push(y)){std::this_thread::yield();}
+	}
+	done=true;
+	for(auto &t : consumers){t.join();}
+	assert(sum==10000L*10001/2);
+}
+
+
+
+//adaptive page sizing : pages grow until processing one takes about target_page_time
+void test_adaptive_pages(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_adaptive",50000);
+
+	decltype(db)::Parallel_options options;
+	options.adaptive =true;
+	options.page_size=1; //first page size
+	options.max_page_size=1024;
+	options.target_page_time=std::chrono::microseconds(500);
+	std::vector<int> seen(v.size(),0);
+	db.getApply_parallel("select i from test_adaptive",[&seen](int i){++seen[i];},options);
+	auto stats = db.parallel_stats();
+	for(int n : seen){assert(n==1);} //every row once
+	assert(stats.rows==v.size());
+	assert(stats.page_size>=1 and stats.page_size<=options.max_page_size);
+	assert(stats.pages>=v.size()/options.max_page_size);
+}
+
+
+
+//dynamic scaling : worker loops are added while pages back up, up to max_threads
+void test_worker_scaling(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_scaling",2000);
+
+	decltype(db)::Parallel_options options;
+	options.page_size  =16;
+	options.threads    =1;
+	options.min_threads=1;
+	options.max_threads=4;
+	std::vector<int> seen(v.size(),0);
+	db.getApply_parallel("select i from test_scaling",[&seen](int i){++seen[i]; usleep(20);},options); //slow rows
+	auto stats = db.parallel_stats();
+	for(int n : seen){assert(n==1);} //every row once, whatever the number of workers
+	assert(stats.peak_threads<=options.max_threads);
+	assert(stats.threads_retired<=stats.threads+stats.threads_started);
+}
+
+
+
+//early termination : fn returns false, or the caller sets the cancel flag
+void test_parallel_stop(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_stop",100000);
+
+	//at most max_pages pages are fetched ahead, so the scan stops long before the end
+	decltype(db)::Parallel_options options;
+	options.page_size=64;
+	options.max_pages=4;
+	std::atomic<size_t> rows(0);
+	const bool all = db.getApply_parallel("select i from test_stop",[&rows](int i)->bool{++rows; return i<1000;},options);
+	assert(!all);
+	assert(db.parallel_stats().stopped);
+	assert(rows<v.size());
+
+	std::atomic<bool> cancel(false);
+	options.cancel=&cancel;
+	rows=0;
+	db.getApply_parallel("select i from test_stop",[&](int){if(++rows==1000){cancel=true;}},options);
+	assert(db.parallel_stats().stopped);
+	assert(rows<v.size());
+}
+
+
+
+//pipeline : fetch, transform in parallel, write the results from the calling thread
+void test_pipeline(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_pipeline",10000,"s varchar");
+
+	const size_t written = db.getPipeline_parallel("select i from test_pipeline",
+			[](int i){return std::make_tuple("s"+std::to_string(i),i);},
+			"update test_pipeline set s=? where i=?");
+	assert(written==v.size());
+
+	size_t n;
+	db.getRow("select count(*) from test_pipeline where s='s'||i",n);
+	assert(n==v.size());
+}
+
+
+
+//work stealing : an idle worker takes chunks of the pages other workers are processing
+void test_work_stealing(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_steal",256);
+
+	//2 pages, the first one is slow : the second worker may steal its chunks
+	decltype(db)::Parallel_options options;
+	options.page_size=128;
+	options.threads  =2;
+	auto run=[&](size_t steal_chunk){
+		options.steal_chunk=steal_chunk;
+		std::vector<int> seen(v.size(),0);
+		db.getApply_parallel("select i from test_steal",[&seen](int i){if(i<128){usleep(200);} ++seen[i];},options);
+		return seen;
+	};
+	const auto not_stolen = run(0);
+	assert(db.parallel_stats().chunks_stolen==0);
+	const auto stolen     = run(4);
+	assert(stolen==not_stolen);
+	for(int n : stolen){assert(n==1);} //every row once
+	assert(db.parallel_stats().chunks_stolen<=v.size()/options.steal_chunk);
+}
+
+
+
+//connection pool : one writer and N readers on a WAL database
+void test_pool(){
+	std::remove("test_wal.sqlite3"); std::remove("test_wal.sqlite3-wal"); std::remove("test_wal.sqlite3-shm");
+	sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>   con("test_wal.sqlite3");
+	sqlwrapper::DbPool<sqlwrapper::Sqlite_tag> pool(con,2);
+	assert(pool.reader_count()==2);
+	{
+		auto writer = pool.writer();
+		make_test_table(*writer,"test_pool",1);
+	}
+
+	//readers run in parallel threads
+	std::atomic<size_t> seen(0);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; ++t){
+		threads.emplace_back([&](){
+			auto reader = pool.reader();
+			size_t n;
+			reader->getRow("select count(*) from test_pool",n);
+			seen+=n;
+		});
+	}
+	for(auto &t : threads){t.join();}
+	assert(seen==4);
+
+	//readers are read only
+	bool thrown=false;
+	try{pool.reader()->execute("insert into test_pool values(2)");}
+	catch(sqlwrapper::DbError &){thrown=true;}
+	assert(thrown);
+
+	auto stats = pool.stats();
+	assert(stats.reader_leases==5);
+	assert(stats.writer_leases==1);
+}
+
+
+
+//performance pragmas are applied when the connection opens, pragmas() reads them back
+void test_pragmas(){
+	typedef sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag> DbConnectInfo_t;
+	std::remove("test_wal.sqlite3"); std::remove("test_wal.sqlite3-wal"); std::remove("test_wal.sqlite3-shm");
+	DbConnectInfo_t con("test_wal.sqlite3");
+	con.page_size   .set(8192);
+	con.journal_mode.set(DbConnectInfo_t::Journal_mode::Wal);
+	con.synchronous .set(DbConnectInfo_t::Synchronous::Normal);
+	con.cache_size  .set(-4000);
+	con.temp_store  .set(DbConnectInfo_t::Temp_store::Memory);
+	con.busy_timeout.set(250);
+	auto db = sqlwrapper::make_DbManager(con);
+	auto p = db.pragmas();
+	assert(p.page_size   ==8192);
+	assert(p.journal_mode==DbConnectInfo_t::Journal_mode::Wal);
+	assert(p.synchronous ==DbConnectInfo_t::Synchronous::Normal);
+	assert(p.cache_size  ==-4000);
+	assert(p.temp_store  ==DbConnectInfo_t::Temp_store::Memory);
+	assert(p.busy_timeout==250);
+
+	//sqlite would ignore it
+	DbConnectInfo_t bad("test_wal.sqlite3");
+	bad.page_size.set(3000);
+	bool thrown=false;
+	try{auto crash_me = sqlwrapper::make_DbManager(bad);}
+	catch(sqlwrapper::DbError_connect &){thrown=true;}
+	assert(thrown);
+}
+
+
+
+//open flags : read only, no creation, in memory
+void test_open_flags(){
+	typedef sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag> DbConnectInfo_t;
+	{
+		DbConnectInfo_t con("test.sqlite3");
+		con.read_only=true;
+		con.threading=DbConnectInfo_t::Threading::Multi_thread;
+		auto db = sqlwrapper::make_DbManager(con);
+		size_t n;
+		db.getRow("select count(*) from test",n);
+		bool thrown=false;
+		try{db.execute("insert into test values(1000,'ro')");}
+		catch(sqlwrapper::DbError &){thrown=true;}
+		assert(thrown);
+	}
+	{
+		std::remove("test_missing.sqlite3");
+		DbConnectInfo_t con("test_missing.sqlite3");
+		con.create=false;
+		bool thrown=false;
+		try{auto crash_me = sqlwrapper::make_DbManager(con);}
+		catch(sqlwrapper::DbError_connect &){thrown=true;}
+		assert(thrown);
+		std::ifstream f("test_missing.sqlite3");
+		assert(!f.good()); //not created
+	}
+	{
+		DbConnectInfo_t con(":memory:");
+		con.threading=DbConnectInfo_t::Threading::Serialized;
+		assert(con.in_memory());
+		auto db = sqlwrapper::make_DbManager(con);
+		db.execute("create table m(i)");
+		db.insertRow("insert into m values(?)",1);
+	}
+}
+
+
+
+//locking policy : with Shared, readers of several threads run concurrently, writers alone
+void test_locking(){
+	typedef sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag> DbConnectInfo_t;
+	DbConnectInfo_t con("test.sqlite3");
+	con.locking  =DbConnectInfo_t::Locking::Shared;
+	con.threading=DbConnectInfo_t::Threading::Serialized; //concurrent readers call sqlite at the same time
+	auto db = sqlwrapper::make_DbManager(con);
+	make_test_table(db,"test_lock",0);
+
+	std::vector<std::thread> threads;
+	std::atomic<bool> ok(true);
+	for(int t = 0; t < 4; ++t){
+		threads.emplace_back([&,t](){
+			for(int i = 0; i < 200; ++i){
+				if(t==0){db.insertRow("insert into test_lock values(?)",i);} //the writer
+				else{
+					size_t n, m;
+					db.getRow("select count(*), coalesce(max(i)+1,0) from test_lock",n,m);
+					if(n!=m){ok=false;} //rows are never seen half written
+				}
+			}
+		});
+	}
+	for(auto &t : threads){t.join();}
+	assert(ok);
+	size_t n;
+	db.getRow("select count(*) from test_lock",n);
+	assert(n==200);
+
+	//a write nested in a read of the same thread runs in the read section
+	db.getApply("select i from test_lock where i<10",[&](int i){db.insertRow("insert into test_lock values(?)",1000+i);});
+	db.getRow("select count(*) from test_lock",n);
+	assert(n==210);
+}
+
+
+
+//memory image : the file is read once, writes stay in memory until persist()
+void test_memory_image(){
+	typedef sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag> DbConnectInfo_t;
+	{
+		auto db = sqlwrapper::make_DbManager(DbConnectInfo_t("test.sqlite3"));
+		make_test_table(db,"test_image",1);
+	}
+
+	DbConnectInfo_t con("test.sqlite3");
+	con.memory_image=true;
+	assert(con.in_memory());
+	auto image = sqlwrapper::make_DbManager(con);
+	image.insertRow("insert into test_image values(?)",2);
+
+	size_t n;
+	{
+		auto file = sqlwrapper::make_DbManager(DbConnectInfo_t("test.sqlite3"));
+		file.getRow("select count(*) from test_image",n);
+		assert(n==1); //not persisted yet
+	}
+
+	image.persist(); //the file must not be open by another connection
+	auto file = sqlwrapper::make_DbManager(DbConnectInfo_t("test.sqlite3"));
+	file.getRow("select count(*) from test_image",n);
+	assert(n==2);
+
+	//a file connection needs a path : persist() would write the file it uses
+	bool thrown=false;
+	try{file.persist();}
+	catch(sqlwrapper::DbError_file &){thrown=true;}
+	assert(thrown);
+}
+
+
+
+//online backup : a background thread copies the database by steps
+void test_backup(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	db.execute("drop table if exists test_backup");
+	db.execute("create table test_backup(i integer NOT NULL, s varchar, primary key(i))");
+	std::vector<std::tuple<int,std::string> > v;
+	for(int i = 0; i < 5000; ++i){v.emplace_back(i,std::string(100,'x'));}
+	db.insertTable_batch("insert into test_backup values(?,?)",v);
+
+	std::remove("test_backup.sqlite3");
+	sqlwrapper::DbBackup<sqlwrapper::Sqlite_tag>::Options options;
+	options.pages_per_step=16;
+	options.pause=std::chrono::milliseconds(0);
+	std::atomic<size_t> calls(0);
+	options.progress=[&calls](const sqlwrapper::DbBackup<sqlwrapper::Sqlite_tag>::Progress &){++calls;};
+	sqlwrapper::DbBackup<sqlwrapper::Sqlite_tag> backup(db,"test_backup.sqlite3",options);
+	backup.wait();
+	auto progress = backup.progress();
+	assert(progress.finished);
+	assert(progress.remaining==0);
+	assert(progress.steps>=size_t(progress.pagecount)/options.pages_per_step); //a step copies at most pages_per_step pages
+	assert(calls==progress.steps);
+
+	auto copy = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test_backup.sqlite3"));
+	size_t n;
+	copy.getRow("select count(*) from test_backup",n);
+	assert(n==v.size());
+}
+
+
+
+//busy retry : a statement that finds the database locked sleeps and retries
+void test_busy_retry(){
+	typedef sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag> DbConnectInfo_t;
+	auto db = sqlwrapper::make_DbManager(DbConnectInfo_t("test.sqlite3"));
+	make_test_table(db,"test_busy",0);
+
+	DbConnectInfo_t con("test.sqlite3");
+	con.busy_retry.max_wait=std::chrono::milliseconds(2000);
+	auto other = sqlwrapper::make_DbManager(con);
+
+	//db holds the write lock for 50ms
+	std::mutex              m;
+	std::condition_variable cond;
+	bool                    locked=false;
+	std::thread writer([&](){
+		db.execute("begin immediate");
+		{
+			std::unique_lock<std::mutex> l(m);
+			locked=true;
+			cond.notify_all();
+		}
+		usleep(50000);
+		db.execute("commit");
+	});
+	{
+		std::unique_lock<std::mutex> l(m);
+		cond.wait(l,[&]{return locked;});
+	}
+	other.insertRow("insert into test_busy values(?)",1); //waits
+	writer.join();
+
+	auto stats = other.busy_stats();
+	assert(stats.busy>0);
+	assert(stats.retries>0);
+	assert(stats.failures==0);
+	size_t n;
+	db.getRow("select count(*) from test_busy",n);
+	assert(n==1);
+}
+
+
+
+//background WAL checkpoints : commits only append to the WAL, a thread copies it to the database
+void test_checkpointer(){
+	std::remove("test_wal.sqlite3"); std::remove("test_wal.sqlite3-wal"); std::remove("test_wal.sqlite3-shm");
+	sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>   con("test_wal.sqlite3");
+	con.journal_mode.set(decltype(con)::Journal_mode::Wal);
+	auto db = sqlwrapper::make_DbManager(con);
+	make_test_table(db,"test_checkpoint",0);
+
+	sqlwrapper::DbCheckpointer<sqlwrapper::Sqlite_tag>::Policy policy;
+	policy.passive_pages=1;
+	sqlwrapper::DbCheckpointer<sqlwrapper::Sqlite_tag> checkpointer(db,policy);
+	for(int i = 0; i < 100; ++i){db.insertRow("insert into test_checkpoint values(?)",i);}
+	for(int i = 0; i < 100 and checkpointer.stats().checkpoints==0; ++i){usleep(10000);}
+	auto stats = checkpointer.stats();
+	assert(stats.checkpoints>0);
+	assert(stats.passive>0);
+	assert(stats.wal_pages>0);
+	assert(db.pragmas().wal_autocheckpoint==0); //replaced by the checkpointer
+}
+
+
+
+//begin modes : an immediate transaction takes the write lock at once
+void test_begin_modes(){
+	auto db    = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	auto other = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	make_test_table(db,"test_begin",0);
+
+	//deferred : no lock until the first statement, other connections still write
+	{
+		auto transaction = db.transaction();
+		other.insertRow("insert into test_begin values(?)",1);
+		transaction.commit();
+	}
+
+	//immediate : other connections cannot write until commit
+	{
+		auto transaction = db.transaction(decltype(db)::Begin_mode::Immediate);
+		bool thrown=false;
+		try{other.insertRow("insert into test_begin values(?)",2);}
+		catch(sqlwrapper::DbError &){thrown=true;}
+		assert(thrown);
+		size_t n;
+		other.getRow("select count(*) from test_begin",n); //reading is allowed
+		assert(n==1);
+		db.insertRow("insert into test_begin values(?)",3);
+		transaction.commit();
+	}
+
+	//exclusive
+	{
+		auto transaction = db.transaction(decltype(db)::Begin_mode::Exclusive);
+		db.insertRow("insert into test_begin values(?)",4);
+		transaction.commit();
+	}
+	size_t n;
+	other.getRow("select count(*) from test_begin",n);
+	assert(n==3);
+}
+
+
+
+//transaction and savepoint statements are prepared once per connection, outside the query cache
+void test_control_statements(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	make_test_table(db,"test_control",0);
+	const auto cache_size = db.query_cache_stats().size;
+
+	for(int i = 0; i < 100; ++i){
+		auto transaction = db.transaction();
+		auto savepoint_1 = db.savepoint();
+		db.insertRow("insert into test_control values(?)",i);
+		{
+			auto savepoint_2 = db.savepoint();
+			db.insertRow("insert into test_control values(?)",1000+i);
+		}//rolled back
+		savepoint_1.commit();
+		if(i%2==0){transaction.commit();}
+	}
+	size_t n;
+	db.getRow("select count(*) from test_control",n);
+	assert(n==50);
+	assert(db.query_cache_stats().size==cache_size+2); //the insert and the select only
+}
+
+
+
+//parallel map-reduce : each worker has its own accumulator, merged at the end
+void test_reduce(){
+	auto db = sqlwrapper::make_DbManager(sqlwrapper::DbConnectInfo<sqlwrapper::Sqlite_tag>("test.sqlite3"));
+	const auto v = make_test_table(db,"test_reduce",10000);
+
+	const long sum = db.getReduce_parallel("select i from test_reduce", long(0),
+			[](long &acc, int i){acc+=i;},
+			[](long &a, const long &b){a+=b;});
+	assert(sum==9999L*10000/2);
+
+	//min_threads above max_threads : the pool runs min_threads worker loops, one accumulator each
+	decltype(db)::Parallel_options options;
+	options.page_size  =16;
+	options.threads    =1;
+	options.min_threads=8;
+	options.max_threads=2;
+	assert(options.max_thread_number()==8);
+	const size_t count = db.getReduce_parallel("select i from test_reduce", size_t(0),
+			[](size_t &acc, int){++acc;},
+			[](size_t &a, const size_t &b){a+=b;},
+			options);
+	assert(count==v.size());
+}
+
+
 int main() {
 
 	//test_multithread();
 	test_classical();
+	test_batch_insert();
+	test_parallel_budget();
 	test_date();
 
 	test_column_description();
+	test_commit_policy();
+	test_thread_pool();
+	test_parallel_ordered();
+	test_partitioned();
+	test_page_recycling();
+	test_ring_buffer();
+	test_adaptive_pages();
+	test_worker_scaling();
+	test_parallel_stop();
+	test_pipeline();
+	test_work_stealing();
+	test_pool();
+	test_pragmas();
+	test_open_flags();
+	test_locking();
+	test_memory_image();
+	test_backup();
+	test_busy_retry();
+	test_checkpointer();
+	test_begin_modes();
+	test_control_statements();
+	test_reduce();
 	std::cout << "everything OK"<<std::endl;
 
 